@@ -0,0 +1,243 @@
+// bignum.c
+// Ann Keenan (akeenan2)
+//
+// Just enough fixed-point arithmetic to compute a Mandelbrot reference orbit at
+// zoom depths where double precision has run out. Results are truncated, not
+// rounded; the guard bits chosen by bignum_limbs_for() absorb the error.
+
+#include "bignum.h"
+
+#include <ctype.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Bits of precision kept beyond the scale of the image
+#define GUARD_BITS 96
+
+// Number of limbs needed to resolve features of size scale
+int bignum_limbs_for(double scale) {
+  int bits = GUARD_BITS;
+  if (scale > 0 && scale < 1) bits += (int) ceil(-log2(scale));
+  int limbs = 1 + (bits + 31) / 32;
+  return limbs > BIGNUM_LIMBS ? BIGNUM_LIMBS : limbs;
+}
+
+void bignum_zero(struct bignum *r, int limbs) {
+  memset(r, 0, sizeof(*r));
+  r->limbs = limbs;
+}
+
+static int mag_cmp(const uint32_t *a, const uint32_t *b, int n) {
+  int i;
+  for (i = 0; i < n; i++) {
+    if (a[i] != b[i]) return a[i] < b[i] ? -1 : 1;
+  }
+  return 0;
+}
+
+static void mag_add(uint32_t *r, const uint32_t *a, const uint32_t *b, int n) {
+  uint64_t carry = 0;
+  int i;
+  for (i = n - 1; i >= 0; i--) {
+    uint64_t t = (uint64_t) a[i] + b[i] + carry;
+    r[i] = (uint32_t) t;
+    carry = t >> 32;
+  }
+}
+
+// r = a - b, where a >= b
+static void mag_sub(uint32_t *r, const uint32_t *a, const uint32_t *b, int n) {
+  int64_t borrow = 0;
+  int i;
+  for (i = n - 1; i >= 0; i--) {
+    int64_t t = (int64_t) a[i] - b[i] - borrow;
+    borrow = t < 0;
+    r[i] = (uint32_t) (t + (borrow << 32));
+  }
+}
+
+static void mag_mul_small(uint32_t *a, uint32_t m, int n) {
+  uint64_t carry = 0;
+  int i;
+  for (i = n - 1; i >= 0; i--) {
+    uint64_t t = (uint64_t) a[i] * m + carry;
+    a[i] = (uint32_t) t;
+    carry = t >> 32;
+  }
+}
+
+static void mag_div_small(uint32_t *a, uint32_t m, int n) {
+  uint64_t rem = 0;
+  int i;
+  for (i = 0; i < n; i++) {
+    uint64_t t = (rem << 32) | a[i];
+    a[i] = (uint32_t) (t / m);
+    rem = t % m;
+  }
+}
+
+static int mag_is_zero(const uint32_t *a, int n) {
+  int i;
+  for (i = 0; i < n; i++) {
+    if (a[i]) return 0;
+  }
+  return 1;
+}
+
+// Parse a decimal number such as "-0.743643887037158704752191506114774" or
+// "1.5e-3" into r. Returns 0 if the string is not a number or is out of range.
+int bignum_parse(struct bignum *r, const char *s, int limbs) {
+  bignum_zero(r, limbs);
+  while (isspace((unsigned char) *s)) s++;
+  if (*s == '-' || *s == '+') r->neg = *s++ == '-';
+
+  // Integer part, which must fit in a single limb
+  uint64_t whole = 0;
+  int digits = 0;
+  for (; isdigit((unsigned char) *s); s++, digits++) {
+    whole = whole*10 + (*s - '0');
+    if (whole > UINT32_MAX) return 0;
+  }
+  r->d[0] = (uint32_t) whole;
+
+  // Fraction digits are added from the last one back: f = (f + digit) / 10
+  if (*s == '.') {
+    const char *start = ++s;
+    while (isdigit((unsigned char) *s)) s++;
+    digits += s - start;
+
+    uint32_t frac[BIGNUM_LIMBS] = {0};
+    const char *p;
+    for (p = s - 1; p >= start; p--) {
+      frac[0] = *p - '0';
+      mag_div_small(frac, 10, limbs);
+    }
+    memcpy(r->d + 1, frac + 1, (limbs - 1)*sizeof(uint32_t));
+  }
+  if (!digits) return 0;
+
+  // Optional decimal exponent
+  if (*s == 'e' || *s == 'E') {
+    char *end;
+    long e = strtol(s + 1, &end, 10);
+    if (end == s + 1) return 0;
+    s = end;
+    for (; e > 0; e--) {
+      if (r->d[0] > UINT32_MAX / 10) return 0;
+      mag_mul_small(r->d, 10, limbs);
+    }
+    for (; e < 0; e++) {
+      mag_div_small(r->d, 10, limbs);
+    }
+  }
+  if (*s) return 0;
+  if (mag_is_zero(r->d, limbs)) r->neg = 0;
+  return 1;
+}
+
+double bignum_to_double(const struct bignum *a) {
+  double v = 0;
+  int i;
+  // Three limbs already exceed the 53 bits of a double's mantissa, but tiny
+  // values need the lower limbs too, so accumulate from the least significant
+  for (i = a->limbs - 1; i >= 0; i--) {
+    v = v / 4294967296.0 + a->d[i];
+  }
+  return a->neg ? -v : v;
+}
+
+// r = v, which must be below 2^32 in magnitude. Bits below the last limb are dropped.
+void bignum_from_double(struct bignum *r, double v, int limbs) {
+  int i;
+  bignum_zero(r, limbs);
+  r->neg = v < 0;
+  v = fabs(v);
+  for (i = 0; i < limbs && v > 0; i++) {
+    r->d[i] = (uint32_t) v;
+    v = (v - r->d[i]) * 4294967296.0;
+  }
+}
+
+// Round a to the double-double hi + lo, carrying about 106 of its bits
+void bignum_to_dd(const struct bignum *a, double *hi, double *lo) {
+  struct bignum h, rest;
+  *hi = bignum_to_double(a);
+  bignum_from_double(&h, *hi, a->limbs);
+  bignum_sub(&rest, a, &h);
+  *lo = bignum_to_double(&rest);
+}
+
+// Write a in decimal to s, to as many digits as its fraction limbs resolve.
+// Digits are truncated like everything else here, so parsing the result may
+// come back one unit of the last limb low. BIGNUM_CHARS always suffices.
+void bignum_format(const struct bignum *a, char *s, int size) {
+  uint32_t frac[BIGNUM_LIMBS];
+  int digits = (int) ceil((a->limbs - 1) * 32 * log10(2.0));
+  int n = snprintf(s, size, "%s%u", a->neg ? "-" : "", a->d[0]);
+  if (a->limbs == 1 || n >= size - 1) return;
+
+  // Each digit is the integer part of the fraction times ten
+  memcpy(frac, a->d, a->limbs*sizeof(uint32_t));
+  s[n++] = '.';
+  for (; digits > 0 && n < size - 1; digits--) {
+    frac[0] = 0;
+    mag_mul_small(frac, 10, a->limbs);
+    s[n++] = '0' + frac[0];
+  }
+  while (s[n-1] == '0') n--;
+  if (s[n-1] == '.') n--;
+  s[n] = 0;
+}
+
+void bignum_add(struct bignum *r, const struct bignum *a, const struct bignum *b) {
+  int n = a->limbs;
+  if (a->neg == b->neg) {
+    mag_add(r->d, a->d, b->d, n);
+    r->neg = a->neg;
+  } else if (mag_cmp(a->d, b->d, n) >= 0) {
+    mag_sub(r->d, a->d, b->d, n);
+    r->neg = a->neg;
+  } else {
+    mag_sub(r->d, b->d, a->d, n);
+    r->neg = b->neg;
+  }
+  r->limbs = n;
+  if (mag_is_zero(r->d, n)) r->neg = 0;
+}
+
+void bignum_sub(struct bignum *r, const struct bignum *a, const struct bignum *b) {
+  struct bignum nb = *b;
+  nb.neg = !nb.neg;
+  bignum_add(r, a, &nb);
+}
+
+// r = a * b, truncated to the same number of limbs. The integer part of the
+// product must fit in one limb, which always holds for unescaped orbit values.
+void bignum_mul(struct bignum *r, const struct bignum *a, const struct bignum *b) {
+  int n = a->limbs;
+  uint32_t p[2*BIGNUM_LIMBS] = {0};
+  int i, j;
+
+  // Schoolbook product with limbs indexed least significant first
+  for (i = 0; i < n; i++) {
+    uint64_t carry = 0;
+    uint32_t ai = a->d[n - 1 - i];
+    if (!ai) continue;
+    for (j = 0; j < n; j++) {
+      uint64_t t = (uint64_t) ai * b->d[n - 1 - j] + p[i + j] + carry;
+      p[i + j] = (uint32_t) t;
+      carry = t >> 32;
+    }
+    p[i + n] = (uint32_t) carry;
+  }
+
+  // Both operands carry n-1 fraction limbs, so the product carries 2n-2
+  for (i = 0; i < n; i++) {
+    r->d[i] = p[2*n - 2 - i];
+  }
+  r->neg = a->neg != b->neg;
+  r->limbs = n;
+  if (mag_is_zero(r->d, n)) r->neg = 0;
+}
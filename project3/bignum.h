@@ -0,0 +1,36 @@
+// bignum.h
+// Ann Keenan (akeenan2)
+
+#ifndef BIGNUM_H
+#define BIGNUM_H
+
+#include <stdint.h>
+
+// Maximum number of 32-bit limbs in a bignum: one integer limb and up to
+// BIGNUM_LIMBS-1 fraction limbs, about 990 bits after the binary point.
+#define BIGNUM_LIMBS 32
+
+// Characters needed to format any bignum: sign, integer limb, point, fraction digits
+#define BIGNUM_CHARS 320
+
+// Signed fixed-point number. d[0] is the integer part and d[1..limbs-1] are the
+// fraction, most significant limb first. Operands of an operation must use the
+// same number of limbs.
+struct bignum {
+  int neg;
+  int limbs;
+  uint32_t d[BIGNUM_LIMBS];
+};
+
+int    bignum_limbs_for(double scale);
+void   bignum_zero(struct bignum *r, int limbs);
+int    bignum_parse(struct bignum *r, const char *s, int limbs);
+double bignum_to_double(const struct bignum *a);
+void   bignum_from_double(struct bignum *r, double v, int limbs);
+void   bignum_to_dd(const struct bignum *a, double *hi, double *lo);
+void   bignum_format(const struct bignum *a, char *s, int size);
+void   bignum_add(struct bignum *r, const struct bignum *a, const struct bignum *b);
+void   bignum_sub(struct bignum *r, const struct bignum *a, const struct bignum *b);
+void   bignum_mul(struct bignum *r, const struct bignum *a, const struct bignum *b);
+
+#endif
@@ -2,6 +2,9 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
 
 #include "bitmap.h"
 
@@ -9,6 +12,9 @@ struct bitmap {
 	int width;
 	int height;
 	int *data;
+	void *map;	/* the mapping holding data, or null if malloced */
+	size_t length;
+	char *path;	/* the file behind the mapping, if any */
 };
 
 struct bitmap * bitmap_create( int w, int h )
@@ -26,13 +32,89 @@ struct bitmap * bitmap_create( int w, int h )
 
 	m->width = w;
 	m->height = h;
+	m->map = 0;
+	m->path = 0;
 
 	return m;
 }
 
+/* Pixels of a mapped file start on a page, after the header and a gap. */
+#define MAPPED_OFFSET 4096
+
+#define HUGEPAGE_SIZE (2<<20)
+
+/*
+Create a bitmap whose pixels are mapped rather than malloced, and are not
+touched here, so each page is placed on the node of the thread that first
+writes it. With a file, the pixels are the pixel array of a 32-bit BMP,
+which has the same layout as the RGBA values in memory, and saving to that
+file is only a header write and an msync, which queues the write-back as
+fclose would. Without one, the memory is anonymous, and BITMAP_HUGEPAGES
+asks for 2MB pages: reserved ones if there are any, else transparent ones.
+Returns null on failure.
+*/
+struct bitmap * bitmap_create_mapped( int w, int h, const char *file, int flags )
+{
+	struct bitmap *m;
+	size_t size = (size_t)w*h*sizeof(int);
+
+	m = calloc(1,sizeof *m);
+	if(!m) return 0;
+	m->width = w;
+	m->height = h;
+
+	if(file) {
+		int fd = open(file,O_RDWR|O_CREAT|O_TRUNC,0644);
+		if(fd<0) {
+			free(m);
+			return 0;
+		}
+		m->length = MAPPED_OFFSET + size;
+		m->path = strdup(file);
+		if(!m->path || ftruncate(fd,m->length)<0 ||
+		   (m->map = mmap(0,m->length,PROT_READ|PROT_WRITE,MAP_SHARED,fd,0))==MAP_FAILED) {
+			close(fd);
+			free(m->path);
+			free(m);
+			return 0;
+		}
+		/* the mapping stays valid once the file is closed. */
+		close(fd);
+		m->data = (int*)((char*)m->map + MAPPED_OFFSET);
+		return m;
+	}
+
+	m->length = size;
+	m->map = MAP_FAILED;
+#ifdef MAP_HUGETLB
+	if(flags & BITMAP_HUGEPAGES) {
+		size_t huge = (size + HUGEPAGE_SIZE - 1)/HUGEPAGE_SIZE*HUGEPAGE_SIZE;
+		m->map = mmap(0,huge,PROT_READ|PROT_WRITE,MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB,-1,0);
+		if(m->map!=MAP_FAILED) m->length = huge;
+	}
+#endif
+	if(m->map==MAP_FAILED) {
+		m->map = mmap(0,size,PROT_READ|PROT_WRITE,MAP_PRIVATE|MAP_ANONYMOUS,-1,0);
+		if(m->map==MAP_FAILED) {
+			free(m);
+			return 0;
+		}
+#ifdef MADV_HUGEPAGE
+		if(flags & BITMAP_HUGEPAGES) madvise(m->map,size,MADV_HUGEPAGE);
+#endif
+	}
+	m->data = m->map;
+	return m;
+}
+
 void bitmap_delete( struct bitmap *m )
 {
-	free(m->data);
+	if(m->map) {
+		munmap(m->map,m->length);
+		free(m->path);
+	} else {
+		free(m->data);
+	}
 	free(m);
 }
 
@@ -79,6 +161,18 @@ int * bitmap_data( struct bitmap *m )
 	return m->data;
 }
 
+/* Return a pointer to the first pixel of row y, which must be in range. */
+int * bitmap_row( struct bitmap *m, int y )
+{
+	return m->data + (long)y*m->width;
+}
+
+/* Copy n pixels into row y starting at column x. The span must fit in the row. */
+void bitmap_set_span( struct bitmap *m, int x, int y, const int *values, int n )
+{
+	memcpy(m->data + (long)y*m->width + x, values, n*sizeof(int));
+}
+
 #pragma pack(1)
 struct bmp_header {
 	char	magic1;
@@ -99,16 +193,107 @@ struct bmp_header {
 	int	icolors;
 };
 
+/* Size of the buffer that rows are converted into before each write. */
+#define SAVE_CHUNK (1<<20)
+
+/* Convert row j into the byte order of the file: BGR for BMP, RGB for PPM. */
+static void bitmap_pack_row( struct bitmap *m, int j, unsigned char *s, int bgr )
+{
+	const int *row = bitmap_row(m,j);
+	int i;
+	for(i=0;i<m->width;i++) {
+		int rgba = row[i];
+		*s++ = bgr ? GET_BLUE(rgba) : GET_RED(rgba);
+		*s++ = GET_GREEN(rgba);
+		*s++ = bgr ? GET_RED(rgba) : GET_BLUE(rgba);
+	}
+}
+
+/*
+Write the pixel rows, in the given order, as packed scanlines padded to
+a multiple of pad bytes. Many rows are converted into one large buffer
+per fwrite, so that the write cost stays small next to rendering.
+*/
+static int bitmap_write_rows( struct bitmap *m, FILE *file, int first, int step, int pad, int bgr )
+{
+	int linelength = (m->width*3 + pad - 1)/pad*pad;
+	int rows = SAVE_CHUNK/linelength;
+	if(rows<1) rows = 1;
+	if(rows>m->height) rows = m->height;
+
+	unsigned char *buffer = calloc(rows,linelength);
+	if(!buffer) return 0;
+
+	int j = first, k, n;
+	int ok = 1;
+	for(k=0;k<m->height && ok;k+=n) {
+		n = m->height-k < rows ? m->height-k : rows;
+		int r;
+		for(r=0;r<n;r++, j+=step) {
+			bitmap_pack_row(m,j,buffer+(long)r*linelength,bgr);
+		}
+		ok = fwrite(buffer,linelength,n,file)==(size_t)n;
+	}
+
+	free(buffer);
+	return ok;
+}
+
+/*
+Save as a binary PPM, which most tools read and which has no scanline
+padding. Rows are written from the top of the image down.
+*/
+static int bitmap_save_ppm( struct bitmap *m, FILE *file )
+{
+	fprintf(file,"P6\n%d %d\n255\n",m->width,m->height);
+	return bitmap_write_rows(m,file,m->height-1,-1,1,0);
+}
+
+/*
+Save a bitmap mapped onto path: the pixels are already in place behind a
+32-bit BMP header, so only the header is written before flushing.
+*/
+static int bitmap_sync( struct bitmap *m )
+{
+	struct bmp_header header;
+
+	memset(&header,0,sizeof(header));
+	header.magic1 = 'B';
+	header.magic2 = 'M';
+	header.size   = m->length;
+	header.offset = MAPPED_OFFSET;
+	header.infosize = sizeof(header)-14;
+	header.width = m->width;
+	header.height = m->height;
+	header.planes = 1;
+	header.bits = 32;
+	header.compression = 0;
+	header.imagesize = m->width*m->height*4;
+	header.xres = 1000;
+	header.yres = 1000;
+
+	memcpy(m->map,&header,sizeof(header));
+	return msync(m->map,m->length,MS_ASYNC)==0;
+}
+
 int bitmap_save( struct bitmap *m, const char *path )
 {
 	FILE *file;
 	struct bmp_header header;
-	int i, j;
-	unsigned char *scanline, *s;
+	int ok;
+
+	if(m->path && strcmp(path,m->path)==0) return bitmap_sync(m);
 
 	file = fopen(path,"wb");
 	if(!file) return 0;
 
+	/* a .ppm extension selects PPM output, everything else is BMP. */
+	const char *ext = strrchr(path,'.');
+	if(ext && strcmp(ext,".ppm")==0) {
+		ok = bitmap_save_ppm(m,file);
+		return fclose(file)==0 && ok;
+	}
+
 	memset(&header,0,sizeof(header));
 	header.magic1 = 'B';
 	header.magic2 = 'M';
@@ -124,30 +309,12 @@ int bitmap_save( struct bitmap *m, const char *path )
 	header.xres = 1000;
 	header.yres = 1000;
 
-	fwrite(&header,1,sizeof(header),file);
-
-	/* if the scanline is not a multiple of four, round it up. */
-	int padlength = 4 - (m->width*3)%4;
-	if(padlength==4) padlength=0;
-
-	scanline = malloc(header.width*3);
+	ok = fwrite(&header,1,sizeof(header),file)==sizeof(header);
 
-	for(j=0;j<m->height;j++) {
-		s = scanline;
-		for(i=0;i<m->width;i++) {
-			int rgba = bitmap_get(m,i,j);
-			*s++ = GET_BLUE(rgba);
-			*s++ = GET_GREEN(rgba);
-			*s++ = GET_RED(rgba);
-		}
-		fwrite(scanline,1,m->width*3,file);
-		fwrite(scanline,1,padlength,file);
-	}
+	/* scanlines are padded to a multiple of four bytes. */
+	ok = ok && bitmap_write_rows(m,file,0,1,4,1);
 
-	free(scanline);
-
-	fclose(file);
-	return 1;
+	return fclose(file)==0 && ok;
 }
 
 struct bitmap * bitmap( const char *path )
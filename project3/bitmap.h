@@ -3,6 +3,7 @@
 #define BITMAP_H
 
 struct bitmap * bitmap_create( int w, int h );
+struct bitmap * bitmap_create_mapped( int w, int h, const char *file, int flags );
 void            bitmap_delete( struct bitmap *b );
 struct bitmap * bitmap_load( const char *file );
 int             bitmap_save( struct bitmap *b, const char *file );
@@ -14,6 +15,13 @@ int   bitmap_height( struct bitmap *b );
 void  bitmap_reset( struct bitmap *b, int value );
 int  *bitmap_data( struct bitmap *b );
 
+/* Flags for bitmap_create_mapped. */
+#define BITMAP_HUGEPAGES 1
+
+/* Unchecked access for inner loops: no coordinate wrapping is done. */
+int  *bitmap_row( struct bitmap *b, int y );
+void  bitmap_set_span( struct bitmap *b, int x, int y, const int *values, int n );
+
 #ifndef MAKE_RGBA
 /** Create a 32-bit RGBA value from 8-bit red, green, blue, and alpha values */
 #define MAKE_RGBA(r,g,b,a) ( (((int)(a))<<24) | (((int)(r))<<16) | (((int)(g))<<8) | (((int)(b))<<0) )
@@ -0,0 +1,200 @@
+// buddha.c
+// Ann Keenan (akeenan2)
+//
+// Buddhabrot renderer. Each thread draws chunks of random points, finds the
+// ones that escape with the vectorized kernel, and traces their orbits again
+// to count every point the orbit passes through. The counts are scattered all
+// over the image, so each thread has its own histogram and never shares a
+// pixel with another while sampling. Once all chunks are done the threads sum
+// the histograms, each over its own band of rows.
+
+#include "buddha.h"
+#include "kernel.h"
+
+#include <errno.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Shared state of one render
+struct buddha {
+  const struct buddha_params *p;
+  int width;
+  int height;
+  int num_threads;
+  long chunks;
+  atomic_long next;         // next chunk to claim
+  uint32_t **hist;          // one width x height histogram per thread
+  pthread_barrier_t sampled;
+  kernel_fn kernel;
+};
+
+struct buddha_worker {
+  struct buddha *b;
+  int id;
+  long orbits;
+  long hits;
+  double reduce;
+};
+
+static double now() {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec*1e-9;
+}
+
+// splitmix64, a small generator whose every seed gives an independent stream
+static uint64_t next_random(uint64_t *state) {
+  uint64_t z = (*state += 0x9e3779b97f4a7c15ULL);
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+  return z ^ (z >> 31);
+}
+
+// Uniform in [-2, 2)
+static double random_coord(uint64_t *state) {
+  return (next_random(state) >> 11) * (4.0/9007199254740992.0) - 2;
+}
+
+// Retrace the first iters steps of the orbit of c, counting the points that fall in the image
+static long trace_orbit(struct buddha *b, uint32_t *hist, double cx, double cy, int iters) {
+  const struct buddha_params *p = b->p;
+  double xmin = p->x - p->scale;
+  double ymin = p->y - p->scale;
+  double xs = b->width/(2*p->scale);
+  double ys = b->height/(2*p->scale);
+  double x = 0, y = 0;
+  long hits = 0;
+  int k;
+
+  for (k = 0; k < iters; k++) {
+    double xt = x*x - y*y + cx;
+    y = 2*x*y + cy;
+    x = xt;
+    int i = (int) floor((x - xmin)*xs);
+    int j = (int) floor((y - ymin)*ys);
+    if (i >= 0 && i < b->width && j >= 0 && j < b->height) {
+      hist[(long) j*b->width + i]++;
+      hits++;
+    }
+  }
+  return hits;
+}
+
+static void *buddha_worker(void *args) {
+  struct buddha_worker *w = args;
+  struct buddha *b = w->b;
+  uint32_t *hist = b->hist[w->id];
+  double cx[BUDDHA_CHUNK], cy[BUDDHA_CHUNK];
+  int iters[BUDDHA_CHUNK];
+  long chunk;
+  int i, t;
+
+  // Sample, claiming chunks until none are left
+  while ((chunk = atomic_fetch_add(&b->next, 1)) < b->chunks) {
+    uint64_t state = chunk;
+    int n = BUDDHA_CHUNK;
+    if ((chunk + 1)*BUDDHA_CHUNK > b->p->samples) n = b->p->samples - chunk*BUDDHA_CHUNK;
+    for (i = 0; i < n; i++) {
+      cx[i] = random_coord(&state);
+      cy[i] = random_coord(&state);
+    }
+
+    // Points that reach max are inside, or too slow to tell; either way not drawn
+    b->kernel(cx, cy, n, b->p->max, iters);
+    for (i = 0; i < n; i++) {
+      if (iters[i] >= b->p->max) continue;
+      w->hits += trace_orbit(b, hist, cx[i], cy[i], iters[i]);
+      w->orbits++;
+    }
+  }
+
+  // Sum every histogram into the first, each thread over its own rows
+  pthread_barrier_wait(&b->sampled);
+  double start = now();
+  long band = ((long) b->height + b->num_threads - 1)/b->num_threads;
+  long j0 = band*w->id*b->width;
+  long j1 = band*(w->id + 1) < b->height ? band*(w->id + 1)*b->width : (long) b->height*b->width;
+  for (t = 1; t < b->num_threads; t++) {
+    uint32_t *src = b->hist[t];
+    long k;
+    for (k = j0; k < j1; k++) {
+      b->hist[0][k] += src[k];
+    }
+  }
+  w->reduce = now() - start;
+  return NULL;
+}
+
+// Render the Buddhabrot of p into bm with num_threads threads, as gray levels
+// growing with the square root of the density. Returns 0, with errno set, if
+// memory or threads run out.
+int buddha_render(struct bitmap *bm, const struct buddha_params *p, int num_threads, struct buddha_stats *stats) {
+  struct buddha b;
+  struct buddha_worker workers[num_threads];
+  pthread_t threads[num_threads];
+  long size = (long) bitmap_width(bm)*bitmap_height(bm);
+  int i, rc, ok = 1;
+
+  b.p = p;
+  b.width = bitmap_width(bm);
+  b.height = bitmap_height(bm);
+  b.num_threads = num_threads;
+  b.chunks = (p->samples + BUDDHA_CHUNK - 1)/BUDDHA_CHUNK;
+  b.kernel = kernel_get(p->kernel);
+  atomic_init(&b.next, 0);
+  if (!(b.hist = calloc(num_threads, sizeof(uint32_t *)))) return 0;
+  for (i = 0; i < num_threads; i++) {
+    if (!(b.hist[i] = calloc(size, sizeof(uint32_t)))) ok = 0;
+  }
+  if (!ok) {
+    for (i = 0; i < num_threads; i++) free(b.hist[i]);
+    free(b.hist);
+    return 0;
+  }
+  pthread_barrier_init(&b.sampled, NULL, num_threads);
+
+  for (i = 0; i < num_threads; i++) {
+    workers[i] = (struct buddha_worker) {&b, i, 0, 0, 0};
+    if ((rc = pthread_create(&threads[i], NULL, buddha_worker, &workers[i])) != 0) {
+      printf("ERROR: Unable to create thread %d with exit code %d.", i, rc);
+      exit(EXIT_FAILURE);
+    }
+  }
+  memset(stats, 0, sizeof(*stats));
+  for (i = 0; i < num_threads; i++) {
+    if ((rc = pthread_join(threads[i], NULL)) != 0) {
+      printf("ERROR: Unable to join thread %d with exit code %d.", i, rc);
+      exit(EXIT_FAILURE);
+    }
+    stats->orbits += workers[i].orbits;
+    stats->hits += workers[i].hits;
+    if (workers[i].reduce > stats->reduce) stats->reduce = workers[i].reduce;
+  }
+  pthread_barrier_destroy(&b.sampled);
+
+  // Map the density to gray
+  uint32_t *hist = b.hist[0];
+  uint32_t top = 1;
+  long k;
+  for (k = 0; k < size; k++) {
+    if (hist[k] > top) top = hist[k];
+  }
+  for (i = 0; i < b.height; i++) {
+    int *row = bitmap_row(bm, i);
+    int x;
+    for (x = 0; x < b.width; x++) {
+      int gray = (int) (255*sqrt((double) hist[(long) i*b.width + x]/top));
+      row[x] = MAKE_RGBA(gray, gray, gray, 0);
+    }
+  }
+
+  for (i = 0; i < num_threads; i++) free(b.hist[i]);
+  free(b.hist);
+  return 1;
+}
@@ -0,0 +1,32 @@
+// buddha.h
+// Ann Keenan (akeenan2)
+
+#ifndef BUDDHA_H
+#define BUDDHA_H
+
+#include "bitmap.h"
+
+// Random points are drawn in chunks of this many, each from its own seed, so the
+// image is the same for any number of threads
+#define BUDDHA_CHUNK 4096
+
+// What to render as a Buddhabrot: the density of the orbits of escaping points
+struct buddha_params {
+  double x;         // center of the image
+  double y;
+  double scale;
+  int max;          // orbits longer than this are taken to be bounded and not drawn
+  long samples;     // random points drawn from the square [-2, 2] x [-2, 2]
+  int kernel;       // iteration kernel that finds the escaping points
+};
+
+// Totals of a Buddhabrot render
+struct buddha_stats {
+  long orbits;      // escaping orbits traced
+  long hits;        // orbit points that landed in the image
+  double reduce;    // seconds spent summing the per-thread histograms
+};
+
+int buddha_render(struct bitmap *bm, const struct buddha_params *p, int num_threads, struct buddha_stats *stats);
+
+#endif
@@ -0,0 +1,541 @@
+// kernel.c
+// Ann Keenan (akeenan2)
+//
+// Scalar and SIMD Mandelbrot iteration kernels in three precisions: float, double
+// and double-double. The vector kernels run 2 to 16 points per instruction and
+// freeze each lane once it escapes, so every lane performs exactly the same
+// sequence of operations as the scalar code; in double precision the result is
+// identical to iterations_at_point(). This file must be built with
+// -ffp-contract=off so that no kernel is fused into FMA instructions, otherwise
+// the results would differ from the scalar code and the double-double error
+// terms would be lost.
+//
+// Points inside the set never escape, so every kernel skips them early: points in
+// the main cardioid or the period-2 bulb are recognized analytically, and an orbit
+// that lands exactly on an earlier value (checked Brent-style against a saved point
+// refreshed at power-of-two intervals) is periodic and therefore bounded.
+//
+// The vector kernels are generated from the templates DEFINE_KERNEL (float and
+// double) and DEFINE_DD_KERNEL (double-double), written with GCC vector extensions
+// so that one body serves every element type and vector width. DEFINE_FAMILY_KERNEL
+// does the same for Julia and Multibrot sets, once per power, so each gets its
+// own hand-expanded complex power with no choice made inside the loop.
+
+#include "kernel.h"
+
+#include <immintrin.h>
+#include <string.h>
+
+// Number of iterations before the first saved point of the periodicity check
+#define PERIOD_START 8
+
+static const char *kernelNames[KERNEL_COUNT] = {"auto", "scalar", "sse2", "avx2", "avx512"};
+static const char *precisionNames[PRECISION_COUNT] = {"auto", "float", "double", "dd", "perturb"};
+
+// Check whether c = x + yi lies in the main cardioid or the period-2 bulb
+static int in_main_bulbs(double x, double y) {
+  double xq = x - 0.25;
+  double q = xq*xq + y*y;
+  if (q*(q + xq) <= 0.25*y*y) return 1;
+  return (x + 1)*(x + 1) + y*y <= 0.0625;
+}
+
+// Return the number of iterations at point x, y in the Mandelbrot space, up to a maximum of max.
+int iterations_at_point(double x, double y, int max) {
+  double x0 = x;
+  double y0 = y;
+  int iter = 0;
+
+  if (in_main_bulbs(x0, y0)) return max;
+
+  // Saved orbit point for the periodicity check
+  double sx = x, sy = y;
+  int check = 0, period = PERIOD_START;
+
+  while ((x*x + y*y <= 4) && iter < max) {
+    double xt = x*x - y*y + x0;
+    double yt = 2*x*y + y0;
+
+    x = xt;
+    y = yt;
+    iter++;
+
+    // The orbit has repeated, so it can never escape
+    if (x == sx && y == sy) return max;
+    if (++check == period) {
+      check = 0;
+      period *= 2;
+      sx = x;
+      sy = y;
+    }
+  }
+  return iter;
+}
+
+static void kernel_scalar(const double *cx, const double *cy, int n, int max, int *iters) {
+  int i;
+  for (i = 0; i < n; i++) {
+    iters[i] = iterations_at_point(cx[i], cy[i], max);
+  }
+}
+
+// Run a vector kernel over the last n < lanes points of a batch by padding them
+// to a full vector with copies of the final point, so short batches stay vectorized
+static void kernel_tail(kernel_fn fn, int lanes, const double *cx, const double *cy, int n, int max, int *iters) {
+  double px[16], py[16];
+  int out[16], k;
+  for (k = 0; k < lanes; k++) {
+    px[k] = cx[k < n ? k : n - 1];
+    py[k] = cy[k < n ? k : n - 1];
+  }
+  fn(px, py, lanes, max, out);
+  for (k = 0; k < n; k++) {
+    iters[k] = out[k];
+  }
+}
+
+// Vector types for the templates. Comparing two V vectors gives a mask vector M
+// of the same width, with all bits set in the lanes where the comparison holds.
+typedef float     v1sf  __attribute__((vector_size(4)));
+typedef int       v1si  __attribute__((vector_size(4)));
+typedef float     v4sf  __attribute__((vector_size(16)));
+typedef int       v4si  __attribute__((vector_size(16)));
+typedef float     v8sf  __attribute__((vector_size(32)));
+typedef int       v8si  __attribute__((vector_size(32)));
+typedef float     v16sf __attribute__((vector_size(64)));
+typedef int       v16si __attribute__((vector_size(64)));
+typedef double    v1df  __attribute__((vector_size(8)));
+typedef long long v1di  __attribute__((vector_size(8)));
+typedef double    v2df  __attribute__((vector_size(16)));
+typedef long long v2di  __attribute__((vector_size(16)));
+typedef double    v4df  __attribute__((vector_size(32)));
+typedef long long v4di  __attribute__((vector_size(32)));
+typedef double    v8df  __attribute__((vector_size(64)));
+typedef long long v8di  __attribute__((vector_size(64)));
+
+// Lane-wise a where mask m is set, b elsewhere
+#define SELECT(V, M, m, a, b) ((V) (((M) (a) & (m)) | ((M) (b) & ~(m))))
+
+// Per instruction set helpers, selected by the prefix passed to the templates:
+// X_ANY(m) is nonzero if any lane of mask m is set, and X_MASK(c) wraps each
+// equality test. SSE2 cannot compare 64-bit integers, and without the empty asm
+// GCC rebuilds the AND of two double comparisons one lane at a time.
+#define SCALAR_ANY(m) ((m)[0])
+#define SCALAR_MASK(c) (c)
+#define SSE2_PS_ANY(m) _mm_movemask_ps((__m128) (m))
+#define SSE2_PS_MASK(c) (c)
+#define SSE2_PD_ANY(m) _mm_movemask_pd((__m128d) (m))
+#define SSE2_PD_MASK(c) ({ v2di c_ = (c); __asm__("" : "+x"(c_)); c_; })
+#define AVX2_PS_ANY(m) _mm256_movemask_ps((__m256) (m))
+#define AVX2_PS_MASK(c) (c)
+#define AVX2_PD_ANY(m) _mm256_movemask_pd((__m256d) (m))
+#define AVX2_PD_MASK(c) (c)
+#define AVX512_ANY(m) _mm512_test_epi32_mask((__m512i) (m), (__m512i) (m))
+#define AVX512_MASK(c) (c)
+
+// Mandelbrot kernel over vectors V of lanes elements of type T, with mask type M.
+// The points are rounded to T, and every step matches iterations_at_point().
+#define DEFINE_KERNEL(name, T, V, M, lanes, isa, ops) \
+__attribute__((target(isa))) \
+static void name(const double *cx, const double *cy, int n, int max, int *iters) { \
+  int i, k, l; \
+  for (i = 0; i + lanes <= n; i += lanes) { \
+    V x0, y0; \
+    for (l = 0; l < lanes; l++) { \
+      x0[l] = (T) cx[i + l]; \
+      y0[l] = (T) cy[i + l]; \
+    } \
+    V x = x0, y = y0, sx = x0, sy = y0; \
+    M count = {0}; \
+    \
+    V y2 = y0*y0; \
+    V xq = x0 - (T) 0.25; \
+    V q = xq*xq + y2; \
+    V xb = x0 + (T) 1; \
+    M done = (q*(q + xq) <= (T) 0.25*y2) | (xb*xb + y2 <= (T) 0.0625); \
+    int check = 0, period = PERIOD_START; \
+    \
+    for (k = 0; k < max; k++) { \
+      V xx = x*x; \
+      V yy = y*y; \
+      M active = ~done & (xx + yy <= (T) 4); \
+      if (!ops##_ANY(active)) break; \
+      \
+      count -= active; \
+      V xt = xx - yy + x0; \
+      V yt = (x + x)*y + y0; \
+      x = SELECT(V, M, active, xt, x); \
+      y = SELECT(V, M, active, yt, y); \
+      \
+      done |= active & ops##_MASK(x == sx) & ops##_MASK(y == sy); \
+      if (++check == period) { \
+        check = 0; \
+        period *= 2; \
+        sx = x; \
+        sy = y; \
+      } \
+    } \
+    count = (done & max) | (~done & count); \
+    for (l = 0; l < lanes; l++) { \
+      iters[i + l] = (int) count[l]; \
+    } \
+  } \
+  if (i < n) kernel_tail(name, lanes, cx + i, cy + i, n - i, max, iters + i); \
+}
+
+// Raise z = x + yi to a fixed power, with xx = x*x and yy = y*y already computed
+#define POWER_2(rx, ry, x, y, xx, yy) do { \
+  rx = xx - yy; \
+  ry = (x + x)*y; \
+} while (0)
+
+#define POWER_3(rx, ry, x, y, xx, yy) do { \
+  rx = x*(xx - 3*yy); \
+  ry = y*(3*xx - yy); \
+} while (0)
+
+#define POWER_4(rx, ry, x, y, xx, yy) do { \
+  __typeof__(x) a_ = xx - yy, b_ = (x + x)*y; \
+  rx = a_*a_ - b_*b_; \
+  ry = (a_ + a_)*b_; \
+} while (0)
+
+#define POWER_5(rx, ry, x, y, xx, yy) do { \
+  __typeof__(x) p_, q_; \
+  POWER_4(p_, q_, x, y, xx, yy); \
+  rx = p_*x - q_*y; \
+  ry = p_*y + q_*x; \
+} while (0)
+
+#define POWER_6(rx, ry, x, y, xx, yy) do { \
+  __typeof__(x) p_, q_; \
+  POWER_3(p_, q_, x, y, xx, yy); \
+  rx = p_*p_ - q_*q_; \
+  ry = (p_ + p_)*q_; \
+} while (0)
+
+// Run a family kernel over the last n < lanes points of a batch, as kernel_tail() does
+static void family_tail(family_fn fn, int lanes, const double *k, const double *cx, const double *cy, int n, int max, int *iters) {
+  double px[16], py[16];
+  int out[16], l;
+  for (l = 0; l < lanes; l++) {
+    px[l] = cx[l < n ? l : n - 1];
+    py[l] = cy[l < n ? l : n - 1];
+  }
+  fn(k, px, py, lanes, max, out);
+  for (l = 0; l < n; l++) {
+    iters[l] = out[l];
+  }
+}
+
+// Kernel for z -> z^power + c, where c is the point for a Multibrot set and the
+// constant k for a Julia set. power and julia are constants, so the power is
+// expanded inline and the choice of c is made once, outside the loop. There are
+// no analytic interior tests for these sets; the periodicity check still applies.
+#define DEFINE_FAMILY_KERNEL(name, T, V, M, lanes, isa, ops, power, julia) \
+__attribute__((target(isa))) \
+static void name(const double *k, const double *cx, const double *cy, int n, int max, int *iters) { \
+  int i, j, l; \
+  for (i = 0; i + lanes <= n; i += lanes) { \
+    V x, y, ax, ay; \
+    for (l = 0; l < lanes; l++) { \
+      x[l] = (T) cx[i + l]; \
+      y[l] = (T) cy[i + l]; \
+      ax[l] = julia ? (T) k[0] : x[l]; \
+      ay[l] = julia ? (T) k[1] : y[l]; \
+    } \
+    V sx = x, sy = y; \
+    M count = {0}, done = {0}; \
+    int check = 0, period = PERIOD_START; \
+    \
+    for (j = 0; j < max; j++) { \
+      V xx = x*x; \
+      V yy = y*y; \
+      M active = ~done & (xx + yy <= (T) 4); \
+      if (!ops##_ANY(active)) break; \
+      \
+      count -= active; \
+      V xt, yt; \
+      POWER_##power(xt, yt, x, y, xx, yy); \
+      x = SELECT(V, M, active, xt + ax, x); \
+      y = SELECT(V, M, active, yt + ay, y); \
+      \
+      done |= active & ops##_MASK(x == sx) & ops##_MASK(y == sy); \
+      if (++check == period) { \
+        check = 0; \
+        period *= 2; \
+        sx = x; \
+        sy = y; \
+      } \
+    } \
+    count = (done & max) | (~done & count); \
+    for (l = 0; l < lanes; l++) { \
+      iters[i + l] = (int) count[l]; \
+    } \
+  } \
+  if (i < n) family_tail(name, lanes, k, cx + i, cy + i, n - i, max, iters + i); \
+}
+
+// Every Multibrot power from 3 and Julia power from 2 for one vector type, and
+// the row of the lookup table that holds them
+#define DEFINE_FAMILY(prefix, T, V, M, lanes, isa, ops) \
+DEFINE_FAMILY_KERNEL(prefix##_multi3, T, V, M, lanes, isa, ops, 3, 0) \
+DEFINE_FAMILY_KERNEL(prefix##_multi4, T, V, M, lanes, isa, ops, 4, 0) \
+DEFINE_FAMILY_KERNEL(prefix##_multi5, T, V, M, lanes, isa, ops, 5, 0) \
+DEFINE_FAMILY_KERNEL(prefix##_multi6, T, V, M, lanes, isa, ops, 6, 0) \
+DEFINE_FAMILY_KERNEL(prefix##_julia2, T, V, M, lanes, isa, ops, 2, 1) \
+DEFINE_FAMILY_KERNEL(prefix##_julia3, T, V, M, lanes, isa, ops, 3, 1) \
+DEFINE_FAMILY_KERNEL(prefix##_julia4, T, V, M, lanes, isa, ops, 4, 1) \
+DEFINE_FAMILY_KERNEL(prefix##_julia5, T, V, M, lanes, isa, ops, 5, 1) \
+DEFINE_FAMILY_KERNEL(prefix##_julia6, T, V, M, lanes, isa, ops, 6, 1)
+
+#define FAMILY_ROW(prefix) { \
+  {NULL, NULL, NULL, prefix##_multi3, prefix##_multi4, prefix##_multi5, prefix##_multi6}, \
+  {NULL, NULL, prefix##_julia2, prefix##_julia3, prefix##_julia4, prefix##_julia5, prefix##_julia6} \
+}
+
+// Double-double arithmetic: a value is the unevaluated sum hi + lo of two doubles,
+// good for about 106 bits. The operands may be doubles or vectors of doubles.
+
+// s + e = a + b exactly
+#define TWO_SUM(s, e, a, b) do { \
+    __typeof__(a) ts_a = (a), ts_b = (b); \
+    (s) = ts_a + ts_b; \
+    __typeof__(ts_a) ts_v = (s) - ts_a; \
+    (e) = (ts_a - ((s) - ts_v)) + (ts_b - ts_v); \
+  } while (0)
+
+// s + e = a + b exactly, given |a| >= |b|
+#define QUICK_TWO_SUM(s, e, a, b) do { \
+    __typeof__(a) qs_a = (a), qs_b = (b); \
+    (s) = qs_a + qs_b; \
+    (e) = qs_b - ((s) - qs_a); \
+  } while (0)
+
+// p + e = a * b exactly, by Dekker's splitting of each factor into 26-bit halves
+#define TWO_PROD(p, e, a, b) do { \
+    __typeof__(a) tp_a = (a), tp_b = (b); \
+    __typeof__(tp_a) tp_t = tp_a*134217729.0; \
+    __typeof__(tp_a) tp_ah = tp_t - (tp_t - tp_a), tp_al = tp_a - tp_ah; \
+    tp_t = tp_b*134217729.0; \
+    __typeof__(tp_a) tp_bh = tp_t - (tp_t - tp_b), tp_bl = tp_b - tp_bh; \
+    (p) = tp_a*tp_b; \
+    (e) = ((tp_ah*tp_bh - (p)) + tp_ah*tp_bl + tp_al*tp_bh) + tp_al*tp_bl; \
+  } while (0)
+
+#define DD_ADD(rh, rl, ah, al, bh, bl) do { \
+    __typeof__(ah) da_s, da_e; \
+    TWO_SUM(da_s, da_e, ah, bh); \
+    da_e += (al) + (bl); \
+    QUICK_TWO_SUM(rh, rl, da_s, da_e); \
+  } while (0)
+
+#define DD_MUL(rh, rl, ah, al, bh, bl) do { \
+    __typeof__(ah) dm_p, dm_e; \
+    TWO_PROD(dm_p, dm_e, ah, bh); \
+    dm_e += (ah)*(bl) + (al)*(bh); \
+    QUICK_TWO_SUM(rh, rl, dm_p, dm_e); \
+  } while (0)
+
+// Double-double Mandelbrot kernel over vectors V of lanes doubles, with mask type M.
+// Point i is center + (dcx[i], dcy[i]), where center holds the real and imaginary
+// parts as {xhi, xlo, yhi, ylo}; the offsets are small enough to be exact doubles.
+#define DEFINE_DD_KERNEL(name, V, M, lanes, isa, ops) \
+__attribute__((target(isa))) \
+static void name(const double *center, const double *dcx, const double *dcy, int n, int max, int *iters) { \
+  int i, k, l; \
+  for (i = 0; i < n; i += lanes) { \
+    /* A short last batch is padded with copies of the final point */ \
+    V dx, dy, cxh, cxl, cyh, cyl, x0h, x0l, y0h, y0l, e; \
+    for (l = 0; l < lanes; l++) { \
+      dx[l] = dcx[i + l < n ? i + l : n - 1]; \
+      dy[l] = dcy[i + l < n ? i + l : n - 1]; \
+      cxh[l] = center[0]; \
+      cxl[l] = center[1]; \
+      cyh[l] = center[2]; \
+      cyl[l] = center[3]; \
+    } \
+    TWO_SUM(x0h, e, cxh, dx); \
+    QUICK_TWO_SUM(x0h, x0l, x0h, e + cxl); \
+    TWO_SUM(y0h, e, cyh, dy); \
+    QUICK_TWO_SUM(y0h, y0l, y0h, e + cyl); \
+    V xh = x0h, xl = x0l, yh = y0h, yl = y0l; \
+    V sxh = xh, sxl = xl, syh = yh, syl = yl; \
+    M count = {0}; \
+    \
+    /* The bulb tests only need the leading part of c */ \
+    V y2 = y0h*y0h; \
+    V xq = x0h - 0.25; \
+    V q = xq*xq + y2; \
+    V xb = x0h + 1; \
+    M done = (q*(q + xq) <= 0.25*y2) | (xb*xb + y2 <= 0.0625); \
+    int check = 0, period = PERIOD_START; \
+    \
+    for (k = 0; k < max; k++) { \
+      V xxh, xxl, yyh, yyl, xyh, xyl, th, tl; \
+      DD_MUL(xxh, xxl, xh, xl, xh, xl); \
+      DD_MUL(yyh, yyl, yh, yl, yh, yl); \
+      M active = ~done & (xxh + yyh <= 4); \
+      if (!ops##_ANY(active)) break; \
+      \
+      count -= active; \
+      DD_MUL(xyh, xyl, xh, xl, yh, yl); \
+      DD_ADD(th, tl, xxh, xxl, -yyh, -yyl); \
+      DD_ADD(th, tl, th, tl, x0h, x0l); \
+      xh = SELECT(V, M, active, th, xh); \
+      xl = SELECT(V, M, active, tl, xl); \
+      DD_ADD(th, tl, 2*xyh, 2*xyl, y0h, y0l); \
+      yh = SELECT(V, M, active, th, yh); \
+      yl = SELECT(V, M, active, tl, yl); \
+      \
+      done |= active & ops##_MASK(xh == sxh) & ops##_MASK(xl == sxl) \
+                      & ops##_MASK(yh == syh) & ops##_MASK(yl == syl); \
+      if (++check == period) { \
+        check = 0; \
+        period *= 2; \
+        sxh = xh; sxl = xl; \
+        syh = yh; syl = yl; \
+      } \
+    } \
+    count = (done & max) | (~done & count); \
+    for (l = 0; l < lanes && i + l < n; l++) { \
+      iters[i + l] = (int) count[l]; \
+    } \
+  } \
+}
+
+DEFINE_KERNEL(kernel_sse2, double, v2df, v2di, 2, "sse2", SSE2_PD)
+DEFINE_KERNEL(kernel_avx2, double, v4df, v4di, 4, "avx2", AVX2_PD)
+DEFINE_KERNEL(kernel_avx512, double, v8df, v8di, 8, "avx512f", AVX512)
+
+DEFINE_KERNEL(kernel_float_scalar, float, v1sf, v1si, 1, "default", SCALAR)
+DEFINE_KERNEL(kernel_float_sse2, float, v4sf, v4si, 4, "sse2", SSE2_PS)
+DEFINE_KERNEL(kernel_float_avx2, float, v8sf, v8si, 8, "avx2", AVX2_PS)
+DEFINE_KERNEL(kernel_float_avx512, float, v16sf, v16si, 16, "avx512f", AVX512)
+
+DEFINE_FAMILY(family_scalar, double, v1df, v1di, 1, "default", SCALAR)
+DEFINE_FAMILY(family_sse2, double, v2df, v2di, 2, "sse2", SSE2_PD)
+DEFINE_FAMILY(family_avx2, double, v4df, v4di, 4, "avx2", AVX2_PD)
+DEFINE_FAMILY(family_avx512, double, v8df, v8di, 8, "avx512f", AVX512)
+
+DEFINE_FAMILY(family_float_scalar, float, v1sf, v1si, 1, "default", SCALAR)
+DEFINE_FAMILY(family_float_sse2, float, v4sf, v4si, 4, "sse2", SSE2_PS)
+DEFINE_FAMILY(family_float_avx2, float, v8sf, v8si, 8, "avx2", AVX2_PS)
+DEFINE_FAMILY(family_float_avx512, float, v16sf, v16si, 16, "avx512f", AVX512)
+
+// Family kernels by precision (double, float), kernel, Julia or not, and power
+static const family_fn familyKernels[2][KERNEL_COUNT][2][FRACTAL_MAX_POWER + 1] = {
+  {FAMILY_ROW(family_scalar), FAMILY_ROW(family_scalar), FAMILY_ROW(family_sse2),
+   FAMILY_ROW(family_avx2), FAMILY_ROW(family_avx512)},
+  {FAMILY_ROW(family_float_scalar), FAMILY_ROW(family_float_scalar), FAMILY_ROW(family_float_sse2),
+   FAMILY_ROW(family_float_avx2), FAMILY_ROW(family_float_avx512)}
+};
+
+DEFINE_DD_KERNEL(kernel_dd_scalar, v1df, v1di, 1, "default", SCALAR)
+DEFINE_DD_KERNEL(kernel_dd_sse2, v2df, v2di, 2, "sse2", SSE2_PD)
+DEFINE_DD_KERNEL(kernel_dd_avx2, v4df, v4di, 4, "avx2", AVX2_PD)
+DEFINE_DD_KERNEL(kernel_dd_avx512, v8df, v8di, 8, "avx512f", AVX512)
+
+// Parse a kernel name given on the command line, returning -1 if unknown
+int kernel_parse(const char *name) {
+  int i;
+  for (i = 0; i < KERNEL_COUNT; i++) {
+    if (strcmp(name, kernelNames[i]) == 0) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+const char *kernel_name(int kind) {
+  if (kind < 0 || kind >= KERNEL_COUNT) return "unknown";
+  return kernelNames[kind];
+}
+
+// Check whether the running CPU can execute the given kernel
+int kernel_supported(int kind) {
+  __builtin_cpu_init();
+  switch (kind) {
+    case KERNEL_AUTO:
+    case KERNEL_SCALAR:
+      return 1;
+    case KERNEL_SSE2:
+      return __builtin_cpu_supports("sse2");
+    case KERNEL_AVX2:
+      return __builtin_cpu_supports("avx2");
+    case KERNEL_AVX512:
+      return __builtin_cpu_supports("avx512f");
+  }
+  return 0;
+}
+
+// Turn KERNEL_AUTO into the widest supported kernel, and fall back to scalar for
+// a kernel the CPU cannot run.
+int kernel_resolve(int kind) {
+  if (kind == KERNEL_AUTO) {
+    for (kind = KERNEL_COUNT - 1; kind > KERNEL_SCALAR; kind--) {
+      if (kernel_supported(kind)) return kind;
+    }
+    return KERNEL_SCALAR;
+  }
+  return kernel_supported(kind) ? kind : KERNEL_SCALAR;
+}
+
+// Parse a precision name given on the command line, returning -1 if unknown
+int precision_parse(const char *name) {
+  int i;
+  for (i = 0; i < PRECISION_COUNT; i++) {
+    if (strcmp(name, precisionNames[i]) == 0) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+const char *precision_name(int precision) {
+  if (precision < 0 || precision >= PRECISION_COUNT) return "unknown";
+  return precisionNames[precision];
+}
+
+kernel_fn kernel_get_float(int kind) {
+  switch (kernel_resolve(kind)) {
+    case KERNEL_SSE2:
+      return kernel_float_sse2;
+    case KERNEL_AVX2:
+      return kernel_float_avx2;
+    case KERNEL_AVX512:
+      return kernel_float_avx512;
+  }
+  return kernel_float_scalar;
+}
+
+kernel_fn kernel_get(int kind) {
+  switch (kernel_resolve(kind)) {
+    case KERNEL_SSE2:
+      return kernel_sse2;
+    case KERNEL_AVX2:
+      return kernel_avx2;
+    case KERNEL_AVX512:
+      return kernel_avx512;
+  }
+  return kernel_scalar;
+}
+
+dd_kernel_fn kernel_get_dd(int kind) {
+  switch (kernel_resolve(kind)) {
+    case KERNEL_SSE2:
+      return kernel_dd_sse2;
+    case KERNEL_AVX2:
+      return kernel_dd_avx2;
+    case KERNEL_AVX512:
+      return kernel_dd_avx512;
+  }
+  return kernel_dd_scalar;
+}
+
+// The kernel for a fractal family in float (single) or double precision, or
+// NULL for the classic Mandelbrot set and for powers out of range
+family_fn kernel_get_family(int kind, const struct fractal *fr, int single) {
+  if (!fr || fr->power < 2 || fr->power > FRACTAL_MAX_POWER) return NULL;
+  return familyKernels[single ? 1 : 0][kernel_resolve(kind)][fr->julia ? 1 : 0][fr->power];
+}
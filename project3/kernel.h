@@ -0,0 +1,63 @@
+// kernel.h
+// Ann Keenan (akeenan2)
+
+#ifndef KERNEL_H
+#define KERNEL_H
+
+// Available iteration kernels. KERNEL_AUTO resolves to the widest one the CPU supports.
+enum {
+  KERNEL_AUTO = 0,
+  KERNEL_SCALAR,
+  KERNEL_SSE2,
+  KERNEL_AVX2,
+  KERNEL_AVX512,
+  KERNEL_COUNT
+};
+
+// Arithmetic used to iterate points, from cheapest to most precise.
+// PRECISION_AUTO picks the cheapest one that resolves the image's pixels.
+enum {
+  PRECISION_AUTO = 0,
+  PRECISION_FLOAT,
+  PRECISION_DOUBLE,
+  PRECISION_DD,       // double-double, about 106 bits
+  PRECISION_PERTURB,  // perturbation against a reference orbit, see perturb.c
+  PRECISION_COUNT
+};
+
+// Compute the escape iteration count of n points (cx[i], cy[i]), up to a maximum of max.
+typedef void (*kernel_fn)(const double *cx, const double *cy, int n, int max, int *iters);
+
+// The same in double-double precision, for the points center + (dcx[i], dcy[i])
+// where center is {xhi, xlo, yhi, ylo}.
+typedef void (*dd_kernel_fn)(const double *center, const double *dcx, const double *dcy, int n, int max, int *iters);
+
+// Fractal families besides the classic Mandelbrot set, iterating z -> z^power + c
+// for powers up to FRACTAL_MAX_POWER. A Multibrot set adds the point itself at
+// each step, like the Mandelbrot set; a Julia set starts z at the point and adds
+// the constant (kx, ky) instead.
+#define FRACTAL_MAX_POWER 6
+
+struct fractal {
+  int julia;
+  int power;
+  double kx;
+  double ky;
+};
+
+// Kernel of a fractal family, with k = {kx, ky} for Julia sets
+typedef void (*family_fn)(const double *k, const double *cx, const double *cy, int n, int max, int *iters);
+
+int         iterations_at_point(double x, double y, int max);
+int         kernel_parse(const char *name);
+const char *kernel_name(int kind);
+int         kernel_supported(int kind);
+int         kernel_resolve(int kind);
+kernel_fn   kernel_get(int kind);
+kernel_fn   kernel_get_float(int kind);
+dd_kernel_fn kernel_get_dd(int kind);
+family_fn   kernel_get_family(int kind, const struct fractal *fr, int single);
+int         precision_parse(const char *name);
+const char *precision_name(int precision);
+
+#endif
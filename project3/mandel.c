@@ -2,30 +2,17 @@
 // Ann Keenan (akeenan2)
 
 #include "bitmap.h"
+#include "buddha.h"
+#include "kernel.h"
+#include "render.h"
 
 #include <ctype.h>
 #include <errno.h>
 #include <getopt.h>
-#include <math.h>
-#include <pthread.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
-
-typedef struct {
-  struct bitmap *bm;
-  int max;
-  double xmin;
-  double xmax;
-  double ymin;
-  double ymax;
-  int num_threads;
-  int id;
-} ThreadArgs;
-
-int iteration_to_color(int, int);
-int iterations_at_point(double, double, int);
-void *compute_image(void *args);
+#include <time.h>
 
 void show_help() {
   printf("Use: mandel [options]\n");
@@ -37,7 +24,27 @@ void show_help() {
   printf("-s <scale>   Scale of the image in Mandlebrot coordinates. (default=4)\n");
   printf("-W <pixels>  Width of the image in pixels. (default=500)\n");
   printf("-H <pixels>  Height of the image in pixels. (default=500)\n");
-  printf("-o <file>    Set output file. (default=mandel.bmp)\n");
+  printf("-o <file>    Set output file, a .ppm name writes PPM instead of BMP. (default=mandel.bmp)\n");
+  printf("-t <pixels>  Size of the square tiles handed out to threads. (default=%d)\n", DEFAULT_TILE_SIZE);
+  printf("-r <mode>    Render mode: full, or subdivide to fill uniform rectangles from their border. (default=full)\n");
+  printf("-k <kernel>  Iteration kernel: auto, scalar, sse2, avx2 or avx512. (default=auto)\n");
+  printf("-p <prec>    Arithmetic: auto, float, double, dd (double-double) or perturb. (default=auto)\n");
+  printf("             auto picks the cheapest one that resolves the pixels at this scale and size.\n");
+  printf("-a <samples> Antialias edge pixels with this many jittered samples: 4, 9, 16, ... (default=1, off)\n");
+  printf("-A <levels>  Color difference from a neighbour that makes a pixel an edge; -1 resamples\n");
+  printf("             every pixel, as full supersampling does. (default=%d)\n", DEFAULT_AA_THRESHOLD);
+  printf("-g           Progressive: save the image after computing 1/16 and 1/4 of the pixels, then in full.\n");
+  printf("-b <samples> Buddhabrot: draw the density of the orbits of this many random points that\n");
+  printf("             escape within max iterations, instead of the escape time of each pixel.\n");
+  printf("             Only for the Mandelbrot set, so not with -z or -j.\n");
+  printf("-d           Deep zoom: perturbation against a high-precision reference orbit, as -p perturb.\n");
+  printf("-z <power>   Iterate z^power + c, a Multibrot set for powers above 2, up to %d. (default=2)\n", FRACTAL_MAX_POWER);
+  printf("-j <re,im>   Draw the Julia set of the constant re + im i instead. Julia and Multibrot sets\n");
+  printf("             are iterated in float or double precision.\n");
+  printf("-M           Map the output file and render straight into it, as a 32-bit BMP.\n");
+  printf("-L           Back the image with 2MB pages where the system allows it.\n");
+  printf("-v           Print each thread's time rendering tiles, tiles and iterations, and the imbalance.\n");
+  printf("-V <file>    As -v, and save a heatmap of the time spent on each tile to file.\n");
   printf("-h           Show this help text.\n");
   printf("\nSome examples are:\n");
   printf("mandel -x -0.5 -y -0.5 -s 0.2\n");
@@ -45,12 +52,53 @@ void show_help() {
   printf("mandel -x 0.286932 -y 0.014287 -s .0005 -m 1000\n\n");
 }
 
+static double now() {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec*1e-9;
+}
+
+// Where a progressive render saves each pass
+struct preview {
+  const char *outfile;
+  double start;
+};
+
+// Save the image of a finished pass, so it can be viewed while the next runs
+static void save_pass(struct frame *f, void *arg) {
+  struct preview *p = arg;
+  const char *what = f->pass == PASS_ANTIALIAS ? "antialiased" : f->stride == 4 ? "1/16" : f->stride == 2 ? "1/4" : "full";
+  if (!bitmap_save(f->bm, p->outfile)) {
+    fprintf(stderr, "mandel: couldn't write to %s: %s\n", p->outfile, strerror(errno));
+    return;
+  }
+  printf("mandel: saved %s image after %.3f s\n", what, now() - p->start);
+  fflush(stdout);
+}
+
+// Show how the work was spread over the threads: a line per thread, then the
+// busiest thread's time over the average and the iteration rate overall
+static void print_stats(struct renderer *r, int num_threads, double seconds) {
+  double busiest = 0, total = 0;
+  long iterations = 0;
+  int i;
+  for (i = 0; i < num_threads; i++) {
+    printf("mandel: thread %d: %.3f s busy, %ld tiles, %ld iterations\n", i, r->stats[i].busy, r->stats[i].tiles, r->stats[i].iterations);
+    iterations += r->stats[i].iterations;
+    total += r->stats[i].busy;
+    if (r->stats[i].busy > busiest) busiest = r->stats[i].busy;
+  }
+  printf("mandel: %.3f s, imbalance %.3f, %.4g iterations/s\n", seconds, total > 0 ? busiest/(total/num_threads) : 1, iterations/seconds);
+}
+
 int main(int argc, char *argv[]) {
   char c;
 
   // These are the default configuration values used
   // if no command line arguments are given.
   const char *outfile = "mandel.bmp";
+  const char *xstr = "0";
+  const char *ystr = "0";
   double xcenter = 0;
   double ycenter = 0;
   double scale = 4;
@@ -58,15 +106,30 @@ int main(int argc, char *argv[]) {
   int    image_height = 500;
   int    max = 1000;
   int    num_threads = 1;
+  int    kernel = KERNEL_AUTO;
+  int    tile_size = DEFAULT_TILE_SIZE;
+  int    mode = RENDER_FULL;
+  int    precision = PRECISION_AUTO;
+  int    samples = 1;
+  struct fractal fractal = {0, 2, 0, 0};
+  int    threshold = DEFAULT_AA_THRESHOLD;
+  int    progressive = 0;
+  long   buddha_samples = 0;
+  int    verbose = 0;
+  int    mapped = 0;
+  int    flags = 0;
+  const char *heatfile = NULL;
 
   // For each command line argument given,
   // override the appropriate configuration value.
-  while ((c = getopt(argc, argv, "x:y:s:W:H:m:o:n:h")) != -1) {
+  while ((c = getopt(argc, argv, "x:y:s:W:H:m:o:n:t:r:k:p:a:A:gb:z:j:dvV:MLh")) != -1) {
     switch(c) {
       case 'x':
+        xstr = optarg;
         xcenter = atof(optarg);
         break;
       case 'y':
+        ystr = optarg;
         ycenter = atof(optarg);
         break;
       case 's':
@@ -91,6 +154,79 @@ int main(int argc, char *argv[]) {
           num_threads = atoi(optarg);
         }
         break;
+      case 't':
+        if (!isdigit(optarg[0]) || atoi(optarg) == 0) {
+          printf("Input tile size '%s' is NaN or less than 1.\nDefaulting to %d pixels.\n", optarg, DEFAULT_TILE_SIZE);
+        } else {
+          tile_size = atoi(optarg);
+        }
+        break;
+      case 'r':
+        if (strcmp(optarg, "full") == 0) {
+          mode = RENDER_FULL;
+        } else if (strcmp(optarg, "subdivide") == 0) {
+          mode = RENDER_SUBDIVIDE;
+        } else {
+          printf("Unknown render mode '%s'.\nDefaulting to full.\n", optarg);
+        }
+        break;
+      case 'k':
+        if ((kernel = kernel_parse(optarg)) == -1) {
+          printf("Unknown kernel '%s'.\nDefaulting to auto.\n", optarg);
+          kernel = KERNEL_AUTO;
+        }
+        break;
+      case 'p':
+        if ((precision = precision_parse(optarg)) == -1) {
+          printf("Unknown precision '%s'.\nDefaulting to auto.\n", optarg);
+          precision = PRECISION_AUTO;
+        }
+        break;
+      case 'z':
+        fractal.power = atoi(optarg);
+        if (fractal.power < 2 || fractal.power > FRACTAL_MAX_POWER) {
+          printf("Power '%s' is not between 2 and %d.\nDefaulting to 2.\n", optarg, FRACTAL_MAX_POWER);
+          fractal.power = 2;
+        }
+        break;
+      case 'j':
+        if (sscanf(optarg, "%lf,%lf", &fractal.kx, &fractal.ky) != 2) {
+          printf("Julia constant '%s' is not of the form re,im.\nDefaulting to the Mandelbrot set.\n", optarg);
+        } else {
+          fractal.julia = 1;
+        }
+        break;
+      case 'a':
+        if (!isdigit(optarg[0]) || atoi(optarg) == 0) {
+          printf("Input samples '%s' is NaN or less than 1.\nDefaulting to 1 sample.\n", optarg);
+        } else {
+          samples = atoi(optarg);
+        }
+        break;
+      case 'A':
+        threshold = atoi(optarg);
+        break;
+      case 'g':
+        progressive = 1;
+        break;
+      case 'b':
+        buddha_samples = atol(optarg);
+        break;
+      case 'd':
+        precision = PRECISION_PERTURB;
+        break;
+      case 'M':
+        mapped = 1;
+        break;
+      case 'L':
+        flags |= BITMAP_HUGEPAGES;
+        break;
+      case 'V':
+        heatfile = optarg;
+        // fall through
+      case 'v':
+        verbose = 1;
+        break;
       case 'h':
         show_help();
         exit(1);
@@ -98,127 +234,114 @@ int main(int argc, char *argv[]) {
     }
   }
 
-  // Ensure valid input for number of threads
-  if (num_threads > image_height) {
-    printf("Number of threads exceed max number allowed.\n Defaulting to %d threads.\n", image_height);
-    num_threads = image_height;
+  // The Buddhabrot is only traced for z^2 + c
+  if (buddha_samples > 0 && (fractal.julia || fractal.power != 2)) {
+    fprintf(stderr, "ERROR: -b draws the Buddhabrot of the Mandelbrot set and can't be combined with -z or -j.\n");
+    return 1;
   }
 
-  // Display the configuration of the image.
-  printf("mandel: x=%lf y=%lf scale=%lf max=%d outfile=%s\n", xcenter, ycenter, scale, max, outfile);
+  // Pick the widest kernel the CPU can run, falling back to scalar
+  if (!kernel_supported(kernel)) {
+    printf("Kernel '%s' is not supported on this CPU.\nDefaulting to scalar.\n", kernel_name(kernel));
+  }
+  kernel = kernel_resolve(kernel);
 
-  // Create a bitmap of the appropriate size.
-  struct bitmap *bm = bitmap_create(image_width, image_height);
+  // Ensure valid input for number of threads
+  int num_tiles = ((image_width + tile_size - 1)/tile_size) * ((image_height + tile_size - 1)/tile_size);
+  if (num_threads > num_tiles) {
+    printf("Number of threads exceed max number allowed.\n Defaulting to %d threads.\n", num_tiles);
+    num_threads = num_tiles;
+  }
 
-  // Fill it with a dark blue, for debugging
-  bitmap_reset(bm, MAKE_RGBA(0, 0, 255, 0));
+  // Create a bitmap of the appropriate size. Its pages are left for the
+  // threads to touch first, so on a NUMA machine each lands on the node of
+  // the thread that renders it. A mapped BMP output file holds the pixels
+  // itself, and saving it only writes the header.
+  const char *ext = strrchr(outfile, '.');
+  struct bitmap *bm = bitmap_create_mapped(image_width, image_height,
+                                           mapped && !(ext && strcmp(ext, ".ppm") == 0) ? outfile : NULL, flags);
+  if (!bm) {
+    fprintf(stderr, "mandel: couldn't allocate a %dx%d image: %s\n", image_width, image_height, strerror(errno));
+    return 1;
+  }
 
-  // Set thread arguments
-  ThreadArgs tArgs[num_threads];
-  int i;
-  for (i = 0; i < num_threads; i++) {
-    tArgs[i].bm = bm;
-    tArgs[i].max = max;
-    tArgs[i].xmin = xcenter - scale;
-    tArgs[i].xmax = xcenter + scale;
-    tArgs[i].ymin = ycenter-scale;
-    tArgs[i].ymax = ycenter+scale;
-    tArgs[i].num_threads = num_threads;
-  }
-
-  // Set threads to be joinable
-  pthread_attr_t attr;
-  pthread_attr_init(&attr);
-  pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_JOINABLE);
-
-  // Create threads
-  int rc;
-  pthread_t threads[num_threads];
-  for (i = 0; i < num_threads; i++) {
-    // printf("DEBUG: Creating thread %d.\n", i);
-    tArgs[i].id = i;
-    if ((rc = pthread_create(&threads[i], NULL, compute_image, (void *) &tArgs[i])) != 0) {
-      printf("ERROR: Unable to create thread %d with exit code %d.", i, rc);
-      exit(EXIT_FAILURE);
+  if (buddha_samples > 0) {
+    struct buddha_params bp = {
+      .x = xcenter, .y = ycenter, .scale = scale, .max = max,
+      .samples = buddha_samples, .kernel = kernel,
+    };
+    struct buddha_stats stats;
+    printf("mandel: buddhabrot x=%lf y=%lf scale=%g max=%d samples=%ld outfile=%s kernel=%s\n", xcenter, ycenter, scale, max, buddha_samples, outfile, kernel_name(kernel));
+    double start = now();
+    if (!buddha_render(bm, &bp, num_threads, &stats)) {
+      fprintf(stderr, "mandel: couldn't allocate %d histograms: %s\n", num_threads, strerror(errno));
+      return 1;
+    }
+    printf("mandel: traced %ld orbits, %ld points in the image, in %.3f s (%.3f s summing histograms)\n",
+           stats.orbits, stats.hits, now() - start, stats.reduce);
+    if (!bitmap_save(bm, outfile)) {
+      fprintf(stderr, "mandel: couldn't write to %s: %s\n", outfile, strerror(errno));
+      return 1;
     }
+    return 0;
   }
 
-  // Join threads
-  for (i = 0; i < num_threads; i++) {
-    if ((rc = pthread_join(threads[i], NULL)) != 0) {
-      printf("ERROR: Unabl to join thread %d with exit code %d.", i, rc);
-      exit(EXIT_FAILURE);
-    }
+  struct preview preview = {outfile, now()};
+  struct render_params params = {
+    .x = xstr, .y = ystr, .scale = scale, .max = max,
+    .kernel = kernel, .mode = mode, .tile_size = tile_size, .precision = precision,
+    .arg = &preview, .samples = samples, .threshold = threshold,
+    .progressive = progressive, .progress = progressive ? save_pass : NULL, .fractal = &fractal,
+  };
+  struct renderer *r = render_create(num_threads);
+  if (!r) {
+    fprintf(stderr, "mandel: couldn't start %d threads: %s\n", num_threads, strerror(errno));
+    return 1;
   }
-  pthread_attr_destroy(&attr);
 
-  // Save the image in the stated file.
-  if (!bitmap_save(bm, outfile)) {
-  fprintf(stderr, "mandel: couldn't write to %s: %s\n", outfile, strerror(errno));
-  return 1;
+  // Queue the image; for deep zooms this computes the reference orbit first
+  struct frame *f = render_submit(r, bm, &params);
+  if (!f) {
+    fprintf(stderr, "mandel: couldn't set up the image at x=%s y=%s: %s\n", xstr, ystr, strerror(errno));
+    return 1;
   }
 
-  return 0;
-}
+  // Display the configuration of the image.
+  printf("mandel: x=%lf y=%lf scale=%g max=%d outfile=%s kernel=%s precision=%s\n", xcenter, ycenter, scale, max, outfile, kernel_name(kernel), precision_name(f->precision));
+  if (f->orbit) {
+    printf("mandel: reference orbit of %d iterations, %d skipped by series approximation\n", f->orbit->len - 1, f->orbit->skip - 1);
+  }
 
-// Compute an entire Mandelbrot image, writing each point to the given bitmap.
-// Scale the image to the range (xmin-xmax, ymin-ymax), limiting iterations to "max"
-void *compute_image(void *args) {
-  ThreadArgs *this = (ThreadArgs *) args;
-  struct bitmap *bm = this->bm;
-  int width = bitmap_width(bm);
-  int height = bitmap_height(bm);
-
-  // Calculate the bounds for the thread
-  int yStart, yEnd;
-  yStart = height/this->num_threads * this->id;
-  if (this->id == this->num_threads - 1) {  // if last thread
-    yEnd = height;
-  } else {
-    yEnd = height/this->num_threads * (this->id+ 1);
-  }
-
-  // For every pixel in the image
-  int i, j;
-  for (j = yStart; j < yEnd; j++) {
-    for (i = 0; i < width; i++) {
-      // Determine the point in x, y space for that pixel.
-      double x = this->xmin + i*(this->xmax - this->xmin)/width;
-      double y = this->ymin + j*(this->ymax - this->ymin)/height;
-
-      // Compute the iterations at that point.
-      int iters = iterations_at_point(x, y, this->max);
-
-      // Set the pixel in the bitmap.
-      bitmap_set(bm, i, j, iters);
+  render_wait(r, f);
+  if (verbose) {
+    print_stats(r, num_threads, now() - preview.start);
+  }
+  if (heatfile) {
+    struct bitmap *heat = bitmap_create(image_width, image_height);
+    if (!heat) {
+      fprintf(stderr, "mandel: couldn't allocate a %dx%d heatmap: %s\n", image_width, image_height, strerror(errno));
+    } else {
+      frame_heatmap(f, heat);
+      if (!bitmap_save(heat, heatfile)) {
+        fprintf(stderr, "mandel: couldn't write to %s: %s\n", heatfile, strerror(errno));
+      }
+      bitmap_delete(heat);
     }
   }
-  return NULL;
-}
-
-
-// Return the number of iterations at point x, y in the Mandelbrot space, up to a maximum of max.
-int iterations_at_point(double x, double y, int max) {
-  double x0 = x;
-  double y0 = y;
-  int iter = 0;
-
-  while ((x*x + y*y <= 4) && iter < max) {
-    double xt = x*x - y*y + x0;
-    double yt = 2*x*y + y0;
-
-    x = xt;
-    y = yt;
-    iter++;
+  if (mode == RENDER_SUBDIVIDE) {
+    printf("mandel: computed %ld of %ld pixels\n", atomic_load(&f->computed), (long) image_width*image_height);
   }
-  return iteration_to_color(iter, max);
-}
+  if (f->grid > 1) {
+    printf("mandel: antialiased %ld of %ld pixels with %d samples\n", atomic_load(&f->resampled), (long) image_width*image_height, f->grid*f->grid);
+  }
+  frame_delete(f);
+  render_delete(r);
 
+  // Save the image in the stated file.
+  if (!bitmap_save(bm, outfile)) {
+  fprintf(stderr, "mandel: couldn't write to %s: %s\n", outfile, strerror(errno));
+  return 1;
+  }
 
-// Convert a iteration number to an RGBA color.
-// Here, we just scale to gray with a maximum of imax.
-// Modify this function to make more interesting colors.
-int iteration_to_color(int i, int max) {
-  int gray = 255 * i/max;
-  return MAKE_RGBA(gray, gray, gray, 0);
+  return 0;
 }
@@ -0,0 +1,189 @@
+// mandelbench.c
+// Ann Keenan (akeenan2)
+//
+// Renders a fixed suite of scenes for every combination of kernel and thread
+// count and prints one CSV line per run, so that kernel and scheduler changes
+// can be compared on the same footing.
+
+#include "bitmap.h"
+#include "kernel.h"
+#include "render.h"
+
+#include <errno.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_THREADS 256
+
+struct scene {
+  const char *name;
+  const char *x;
+  const char *y;
+  double scale;
+  int max;
+  int width;
+  int height;
+};
+
+static const struct scene scenes[] = {
+  // The two views of the report
+  {"curveA", "-0.5", "0.5", 1, 1000, 2000, 2000},
+  {"curveB", "0.2869325", "0.0142905", 0.000001, 1000, 1024, 1024},
+  // Mostly inside the set, around the period-3 bulb which no analytic test covers
+  {"interior", "-0.12", "0.75", 0.15, 5000, 1024, 1024},
+  // Beyond double precision
+  {"deep", "-0.743643887037158704752191506114774", "0.131825904205311970493132056385139", 1e-14, 4000, 256, 256}
+};
+
+#define NUM_SCENES (int) (sizeof(scenes)/sizeof(scenes[0]))
+
+void show_help() {
+  printf("Use: mandelbench [options]\n");
+  printf("Where options are:\n");
+  printf("-n <threads> Largest number of threads; runs use 1, 2, 4, ... up to it. (default=number of CPUs)\n");
+  printf("-k <kernel>  Only run this kernel: scalar, sse2, avx2 or avx512. (default=all supported)\n");
+  printf("-s <scene>   Only run this scene:");
+  int i;
+  for (i = 0; i < NUM_SCENES; i++) {
+    printf(" %s", scenes[i].name);
+  }
+  printf(". (default=all)\n");
+  printf("-p <prec>    Arithmetic: auto, float, double, dd or perturb. (default=auto)\n");
+  printf("-r <runs>    Repeat each run and report the fastest. (default=1)\n");
+  printf("-h           Show this help text.\n");
+  printf("\nColumns: wall time in seconds, megapixels per second, iterations per second\n");
+  printf("(the sum of every pixel's iteration count), and load imbalance, the busiest\n");
+  printf("thread's time rendering tiles over the average.\n");
+}
+
+static double now() {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec*1e-9;
+}
+
+// Render one scene, filling in the wall time, total iterations and imbalance.
+// Returns the precision used, or -1 on failure.
+static int run(const struct scene *sc, int kernel, int precision, int num_threads, struct bitmap *bm,
+               double *seconds, long *iterations, double *imbalance) {
+  struct render_params params = {
+    .x = sc->x, .y = sc->y, .scale = sc->scale, .max = sc->max,
+    .kernel = kernel, .mode = RENDER_FULL, .tile_size = DEFAULT_TILE_SIZE, .precision = precision,
+  };
+  double start = now();
+  struct renderer *r = render_create(num_threads);
+  if (!r) return -1;
+  struct frame *f = render_submit(r, bm, &params);
+  if (!f) {
+    render_delete(r);
+    return -1;
+  }
+  render_wait(r, f);
+  *seconds = now() - start;
+
+  double busiest = 0, total = 0;
+  int i;
+  *iterations = 0;
+  for (i = 0; i < num_threads; i++) {
+    *iterations += r->stats[i].iterations;
+    total += r->stats[i].busy;
+    if (r->stats[i].busy > busiest) busiest = r->stats[i].busy;
+  }
+  *imbalance = total > 0 ? busiest/(total/num_threads) : 1;
+
+  precision = f->precision;
+  frame_delete(f);
+  render_delete(r);
+  return precision;
+}
+
+int main(int argc, char *argv[]) {
+  int c;
+  int max_threads = sysconf(_SC_NPROCESSORS_ONLN);
+  int only_kernel = KERNEL_AUTO;
+  const char *only_scene = NULL;
+  int precision = PRECISION_AUTO;
+  int runs = 1;
+
+  while ((c = getopt(argc, argv, "n:k:s:p:r:h")) != -1) {
+    switch(c) {
+      case 'n':
+        max_threads = atoi(optarg);
+        break;
+      case 'k':
+        if ((only_kernel = kernel_parse(optarg)) == -1) {
+          fprintf(stderr, "Unknown kernel '%s'.\n", optarg);
+          return EXIT_FAILURE;
+        }
+        break;
+      case 's':
+        only_scene = optarg;
+        break;
+      case 'p':
+        if ((precision = precision_parse(optarg)) == -1) {
+          fprintf(stderr, "Unknown precision '%s'.\n", optarg);
+          return EXIT_FAILURE;
+        }
+        break;
+      case 'r':
+        runs = atoi(optarg);
+        break;
+      case 'h':
+      default:
+        show_help();
+        return EXIT_FAILURE;
+    }
+  }
+  if (max_threads < 1 || max_threads > MAX_THREADS || runs < 1) {
+    fprintf(stderr, "ERROR: Threads must be between 1 and %d and runs at least 1.\n", MAX_THREADS);
+    return EXIT_FAILURE;
+  }
+
+  printf("scene,width,height,max,kernel,precision,threads,seconds,mpix_per_s,iters_per_s,imbalance\n");
+
+  int i, k, n;
+  for (i = 0; i < NUM_SCENES; i++) {
+    const struct scene *sc = &scenes[i];
+    if (only_scene && strcmp(only_scene, sc->name) != 0) continue;
+
+    struct bitmap *bm = bitmap_create(sc->width, sc->height);
+    if (!bm) {
+      fprintf(stderr, "mandelbench: couldn't allocate a %dx%d image\n", sc->width, sc->height);
+      return EXIT_FAILURE;
+    }
+
+    for (k = KERNEL_SCALAR; k < KERNEL_COUNT; k++) {
+      if (only_kernel != KERNEL_AUTO && k != only_kernel) continue;
+      if (!kernel_supported(k)) continue;
+
+      // Double the threads up to the limit, and always include the limit itself
+      for (n = 1; ; n = 2*n < max_threads ? 2*n : max_threads) {
+        double best = 0, imbalance = 1, seconds, imb;
+        long iterations = 0;
+        int used = -1, run_i;
+        for (run_i = 0; run_i < runs; run_i++) {
+          if ((used = run(sc, k, precision, n, bm, &seconds, &iterations, &imb)) == -1) {
+            fprintf(stderr, "mandelbench: couldn't render %s: %s\n", sc->name, strerror(errno));
+            return EXIT_FAILURE;
+          }
+          if (run_i == 0 || seconds < best) {
+            best = seconds;
+            imbalance = imb;
+          }
+        }
+
+        double pixels = (double) sc->width*sc->height;
+        printf("%s,%d,%d,%d,%s,%s,%d,%.4f,%.2f,%.4g,%.3f\n", sc->name, sc->width, sc->height, sc->max,
+               kernel_name(k), precision_name(used), n, best, pixels/best/1e6, iterations/best, imbalance);
+        fflush(stdout);
+        if (n == max_threads) break;
+      }
+    }
+    bitmap_delete(bm);
+  }
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,39 @@
+#!/usr/bin/env python3
+# -*- coding: UTF-8 -*-
+
+# mandelclient.py
+# Ann Keenan (akeenan2)
+# Fetch a grid of tiles around a view from mandelserver and save them as BMPs
+import sys
+import zmq
+
+SERVER = 'localhost'
+PORT = '6600'  # default port
+
+if len(sys.argv) < 6:  # invalid command line call
+    print('''Usage: python3 mandelclient.py X Y SCALE MAX SIZE [RADIUS] [PORT]''')
+    exit(1)
+
+x, y, scale, max_iter, size = sys.argv[1:6]
+radius = int(sys.argv[6]) if len(sys.argv) > 6 else 1
+if len(sys.argv) > 7:
+    PORT = sys.argv[7]
+
+# Create socket and connect to server
+context = zmq.Context()
+socket = context.socket(zmq.REQ)
+socket.connect('tcp://%s:%s' % (SERVER, PORT))
+
+# Request every tile within radius of the center one
+for ty in range(-radius, radius + 1):
+    for tx in range(-radius, radius + 1):
+        socket.send_string('tile %s %s %s %s %s %d %d' % (x, y, scale, max_iter, size, tx, ty))
+        reply = socket.recv()
+        if reply.startswith(b'Error'):
+            print(reply.decode(), end='')
+            exit(1)
+        with open('tile_%d_%d.bmp' % (tx, ty), 'wb') as f:
+            f.write(reply)
+
+socket.send_string('stats')
+print(socket.recv_string(), end='')
@@ -1,127 +1,351 @@
 // mandelmovie.c
 // Ann Keenan (akeenan2)
 
-#include <ctype.h>
+#include "bitmap.h"
+#include "kernel.h"
+#include "render.h"
+#include "video.h"
+
 #include <errno.h>
-#include <fnmatch.h>
-#include <limits.h>
+#include <getopt.h>
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/types.h>
 #include <unistd.h>
-#include <sys/wait.h>
 
-#define MAX_IMAGES 50
-#define MAX_PROCESSES MAX_IMAGES
-#define MAXBUF 256
+#define MAX_THREADS 256
 #define MAX_ZOOM 2
 #define MIN_ZOOM 0.00001
 
-void buildCommand(char **, double, int);
+void show_help() {
+  printf("Use: mandelmovie [options] [threads]\n");
+  printf("Where options are:\n");
+  printf("-n <threads> The number of render threads shared by all frames. (default=number of CPUs)\n");
+  printf("-f <frames>  The number of frames in the movie. (default=50)\n");
+  printf("-x <coord>   X coordinate of the zoom center. (default=0.2910234)\n");
+  printf("-y <coord>   Y coordinate of the zoom center. (default=-0.0164365)\n");
+  printf("-s <scale>   Scale of the first frame. (default=%g)\n", (double) MAX_ZOOM);
+  printf("-e <scale>   Scale of the last frame. (default=%g)\n", MIN_ZOOM);
+  printf("-m <max>     The maximum number of iterations per point. (default=4000)\n");
+  printf("-W <pixels>  Width of each frame in pixels. (default=700)\n");
+  printf("-H <pixels>  Height of each frame in pixels. (default=700)\n");
+  printf("-o <output>  Prefix of the BMP frames <prefix><number>.bmp, or the file for a\n");
+  printf("             y4m or rgb stream, where - is standard output. (default=mandel)\n");
+  printf("-O <format>  Output format: bmp, y4m or rgb. (default=bmp)\n");
+  printf("-F <fps>     Frame rate recorded in a y4m stream. (default=25)\n");
+  printf("-t <pixels>  Size of the square tiles handed out to threads. (default=%d)\n", DEFAULT_TILE_SIZE);
+  printf("-r <mode>    Render mode: full or subdivide. (default=full)\n");
+  printf("-k <kernel>  Iteration kernel: auto, scalar, sse2, avx2 or avx512. (default=auto)\n");
+  printf("-p <prec>    Arithmetic: auto, float, double, dd or perturb. auto picks the cheapest\n");
+  printf("             one that resolves the pixels of each frame. (default=auto)\n");
+  printf("-a <samples> Antialias edge pixels with this many jittered samples: 4, 9, 16, ... (default=1, off)\n");
+  printf("-A <levels>  Color difference from a neighbour that makes a pixel an edge. (default=%d)\n", DEFAULT_AA_THRESHOLD);
+  printf("-K <frames>  Keyframe mode: render every <frames>th frame oversize, resample the frames\n");
+  printf("             up to the next one from it and compute only the pixels that it does not\n");
+  printf("             resolve, judged by -A. (default=0, off)\n");
+  printf("-Q <factor>  Size of the keyframes relative to the frames. (default=1.5)\n");
+  printf("-z <power>   Iterate z^power + c, a Multibrot set for powers above 2, up to %d. (default=2)\n", FRACTAL_MAX_POWER);
+  printf("-j <re,im>   Draw the Julia set of the constant re + im i instead. Julia and Multibrot sets\n");
+  printf("             are iterated in float or double precision.\n");
+  printf("-h           Show this help text.\n");
+  printf("\nCurve B of the report is:\n");
+  printf("mandelmovie -x 0.2869325 -y 0.0142905 -e .000001 -m 1000 -W 1024 -H 1024 -n 8\n");
+  printf("\nTo encode without intermediate files:\n");
+  printf("mandelmovie -O y4m -o - | ffmpeg -i - mandel.mpg\n\n");
+}
+
+// A frame in flight, and the encoded copy of it waiting for its turn to be written
+struct slot {
+  struct bitmap *bm;
+  struct frame *f;
+  unsigned char *buf;
+  struct video *v;
+};
+
+// Frames finish out of order, so each is encoded as soon as it is done by the
+// worker that finished it, and held in its slot until the earlier ones are out
+static void encode_frame(struct frame *f, void *arg) {
+  struct slot *s = arg;
+  video_encode(s->v, s->bm, s->buf);
+}
+
+// An oversize frame that the frames of a keyframe group are resampled from
+struct keyslot {
+  struct frame *f;      // NULL once finished
+  struct keyframe key;
+};
 
 int main(int argc, char *argv[]) {
-  // Ensure valid execution of the program
-  int numProcesses = 1;
-  if (argc == 1) {
-    printf("No number of processes specified. Defaulting to %d.\n", numProcesses);
-  } else if (argc > 2) {
-    printf("Usage: ./mandelmovie n\n    n    number of processes\n");
+  int c;
+
+  // These are the default configuration values used
+  // if no command line arguments are given.
+  const char *output = "mandel";
+  const char *xstr = "0.2910234";
+  const char *ystr = "-0.0164365";
+  double start = MAX_ZOOM;
+  double end = MIN_ZOOM;
+  int    num_frames = 50;
+  int    image_width = 700;
+  int    image_height = 700;
+  int    max = 4000;
+  int    num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+  int    kernel = KERNEL_AUTO;
+  int    tile_size = DEFAULT_TILE_SIZE;
+  int    mode = RENDER_FULL;
+  int    precision = PRECISION_AUTO;
+  int    format = VIDEO_BMP;
+  int    fps = 25;
+  int    samples = 1;
+  int    interval = 0;
+  double oversize = 1.5;
+  struct fractal fractal = {0, 2, 0, 0};
+  int    threshold = DEFAULT_AA_THRESHOLD;
+
+  while ((c = getopt(argc, argv, "n:f:x:y:s:e:m:W:H:o:O:F:t:r:k:p:a:A:K:Q:z:j:h")) != -1) {
+    switch(c) {
+      case 'n':
+        num_threads = atoi(optarg);
+        break;
+      case 'f':
+        num_frames = atoi(optarg);
+        break;
+      case 'x':
+        xstr = optarg;
+        break;
+      case 'y':
+        ystr = optarg;
+        break;
+      case 's':
+        start = atof(optarg);
+        break;
+      case 'e':
+        end = atof(optarg);
+        break;
+      case 'm':
+        max = atoi(optarg);
+        break;
+      case 'W':
+        image_width = atoi(optarg);
+        break;
+      case 'H':
+        image_height = atoi(optarg);
+        break;
+      case 'o':
+        output = optarg;
+        break;
+      case 'O':
+        if ((format = video_parse(optarg)) == -1) {
+          fprintf(stderr, "Unknown output format '%s'.\nDefaulting to bmp.\n", optarg);
+          format = VIDEO_BMP;
+        }
+        break;
+      case 'F':
+        fps = atoi(optarg);
+        break;
+      case 't':
+        tile_size = atoi(optarg);
+        break;
+      case 'r':
+        if (strcmp(optarg, "subdivide") == 0) {
+          mode = RENDER_SUBDIVIDE;
+        } else if (strcmp(optarg, "full") != 0) {
+          fprintf(stderr, "Unknown render mode '%s'.\nDefaulting to full.\n", optarg);
+        }
+        break;
+      case 'k':
+        if ((kernel = kernel_parse(optarg)) == -1) {
+          fprintf(stderr, "Unknown kernel '%s'.\nDefaulting to auto.\n", optarg);
+          kernel = KERNEL_AUTO;
+        }
+        break;
+      case 'p':
+        if ((precision = precision_parse(optarg)) == -1) {
+          fprintf(stderr, "Unknown precision '%s'.\nDefaulting to auto.\n", optarg);
+          precision = PRECISION_AUTO;
+        }
+        break;
+      case 'K':
+        interval = atoi(optarg);
+        break;
+      case 'Q':
+        oversize = atof(optarg);
+        break;
+      case 'z':
+        fractal.power = atoi(optarg);
+        if (fractal.power < 2 || fractal.power > FRACTAL_MAX_POWER) {
+          fprintf(stderr, "Power '%s' is not between 2 and %d.\nDefaulting to 2.\n", optarg, FRACTAL_MAX_POWER);
+          fractal.power = 2;
+        }
+        break;
+      case 'j':
+        if (sscanf(optarg, "%lf,%lf", &fractal.kx, &fractal.ky) != 2) {
+          fprintf(stderr, "Julia constant '%s' is not of the form re,im.\nDefaulting to the Mandelbrot set.\n", optarg);
+        } else {
+          fractal.julia = 1;
+        }
+        break;
+      case 'a':
+        samples = atoi(optarg);
+        break;
+      case 'A':
+        threshold = atoi(optarg);
+        break;
+      case 'h':
+      default:
+        show_help();
+        return EXIT_FAILURE;
+    }
+  }
+
+  // The number of threads may still be given on its own, as in ./mandelmovie n
+  if (optind < argc) {
+    num_threads = atoi(argv[optind]);
+  }
+
+  // Ensure valid input
+  if (num_threads < 1) {
+    fprintf(stderr, "ERROR: Number of threads NaN or less than 1. Defaulting to 1.\n");
+    num_threads = 1;
+  } else if (num_threads > MAX_THREADS) {
+    fprintf(stderr, "ERROR: Input exceed max number of threads allowed: %d. Defaulting to 1.\n", MAX_THREADS);
+    num_threads = 1;
+  }
+  if (num_frames < 1 || image_width < 1 || image_height < 1 || max < 1 || start <= 0 || end <= 0 || fps < 1) {
+    fprintf(stderr, "ERROR: Frames, size, iterations, scales and frame rate must all be positive.\n");
+    return EXIT_FAILURE;
+  }
+  if (interval < 0 || oversize < 1) {
+    fprintf(stderr, "ERROR: The keyframe interval can't be negative or the keyframes smaller than the frames.\n");
+    return EXIT_FAILURE;
+  }
+  kernel = kernel_resolve(kernel);
+
+  struct video *v = video_open(format, output, image_width, image_height, fps);
+  if (!v) {
+    fprintf(stderr, "mandelmovie: couldn't open %s: %s\n", output, strerror(errno));
     return EXIT_FAILURE;
-  } else if (!isdigit(argv[1][0]) || atoi(argv[1])==0) {
-    printf("ERROR: '%s' NaN or less than 1. Defaulting to 1.\n", argv[1]);
-  } else if (atoi(argv[1]) > MAX_PROCESSES) {
-    printf("ERROR: Input exceed max number of processes allowed: %d. Defaulting to 1.\n", MAX_PROCESSES);
-  } else {
-    numProcesses = atoi(argv[1]);
   }
 
-  double s = 2;
-  double base = exp(log(MIN_ZOOM/MAX_ZOOM)/(MAX_IMAGES-1));
-  int n = 0;  // number of running processes
-  pid_t pids[MAX_IMAGES];
+  struct renderer *r = render_create(num_threads);
+  if (!r) {
+    fprintf(stderr, "mandelmovie: couldn't start %d threads: %s\n", num_threads, strerror(errno));
+    return EXIT_FAILURE;
+  }
 
+  // Keep a few more frames in flight than there are threads, so workers move on
+  // to the next frame while earlier ones are being saved. Their slots are reused.
+  int window = num_threads + 1 < num_frames ? num_threads + 1 : num_frames;
+  struct slot slots[window];
   int i;
-  for (i = 0; i < MAX_IMAGES; i++) {
-    // Execute n number of processes
-    if (n < numProcesses) {
-      // Fork a child process and execute the command
-      pids[i] = fork();
-      n++;
-
-      // Error
-      if (pids[i] == -1) {
-    		printf("ERROR: Failure to fork\n");
-
-      // Child process
-      } else if (pids[i] == 0) {
-        char *command[18];
-        s = 2 * pow(base, i);
-        buildCommand(command, s, i+1);
-
-        // printf("DEBUG: Started process %d.\n", pid);
-        execvp(command[0], command);
-    		printf("ERROR: Failure starting command for i=%d\n", i+1);
-        _exit(EXIT_FAILURE);
-
-      // Parent process
-      } else {
-        // Wait until a process finishes
-        while (n >= numProcesses) {
-          int status, wpid;
-          wpid = wait(&status);
-
-      		if (status) {  // error
-    				printf("ERROR: Process %d exited with status %d.\n", wpid, status);
-            // exit(EXIT_FAILURE);
-    			} else if (wpid != 0) {  // success in waiting
-            // printf("DEBUG: Process %d completed with status %d.\n", wpid, status);
-            n--;
-    			}
-        }
-      }
+  for (i = 0; i < window; i++) {
+    slots[i].bm = bitmap_create(image_width, image_height);
+    // BMP frames are written straight from the bitmap and need no buffer
+    slots[i].buf = format != VIDEO_BMP ? malloc(video_frame_size(v)) : NULL;
+    slots[i].v = v;
+    if (!slots[i].bm || (format != VIDEO_BMP && !slots[i].buf)) {
+      fprintf(stderr, "mandelmovie: couldn't allocate a %dx%d frame\n", image_width, image_height);
+      return EXIT_FAILURE;
     }
   }
 
-  // Clean up remaining processes
-  while (n > 0) {
-    int status, wpid;
-    wpid = wait(&status);
-    if (status) {  // error
-      printf("ERROR: Process %d exited with status %d.\n", wpid, status);
+  // In keyframe mode the first frame of each group of interval frames is also
+  // rendered oversize, and the whole group is resampled from it. Two keyframe
+  // buffers alternate: keyframe g reuses the one of keyframe g-2 once all of
+  // group g-2 is written, that is once frame i reaches group g-1.
+  struct keyslot keys[2];
+  int key_next = 0;   // next keyframe to submit
+  for (i = 0; i < 2 && interval; i++) {
+    keys[i].f = NULL;
+    keys[i].key.bm = bitmap_create((int) ceil(image_width*oversize), (int) ceil(image_height*oversize));
+    if (!keys[i].key.bm) {
+      fprintf(stderr, "mandelmovie: couldn't allocate a keyframe\n");
+      return EXIT_FAILURE;
     }
-    n--;
   }
 
-  return EXIT_SUCCESS;
-}
+  // Every frame zooms in by the same factor
+  double base = num_frames > 1 ? exp(log(end/start)/(num_frames-1)) : 1;
+  struct render_params params = {
+    .x = xstr, .y = ystr, .scale = start, .max = max,
+    .kernel = kernel, .mode = mode, .tile_size = tile_size, .precision = precision,
+    .finish = encode_frame, .samples = samples, .threshold = threshold, .fractal = &fractal,
+  };
+  int next = 0;   // next frame to submit
+  long points = 0;
+  int status = EXIT_SUCCESS;
+
+  for (i = 0; i < num_frames; i++) {
+    // Start keyframes as soon as their buffers are free
+    for (; interval && key_next*interval < num_frames && (key_next - 1)*interval <= i; key_next++) {
+      struct keyslot *k = &keys[key_next % 2];
+      struct render_params kp = params;
+      kp.scale = k->key.scale = start * pow(base, key_next*interval);
+      kp.finish = NULL;
+      kp.arg = NULL;
+      if (!(k->f = render_submit(r, k->key.bm, &kp))) {
+        fprintf(stderr, "mandelmovie: couldn't set up keyframe %d: %s\n", key_next + 1, strerror(errno));
+        return EXIT_FAILURE;
+      }
+    }
 
-// Build the command to be run
-void buildCommand(char **cmd, double s, int i) {
-  char filename[13];
-  char s_str[10];
-  snprintf(filename, 13, "mandel%d.bmp", i);
-  snprintf(s_str, 10, "%f", s);
-
-// ./mandel -x 0.2910234 -y -0.0164365 -s .00001 -m 1000 -W 700 -H 700
-  cmd[0] = strdup("./mandel");
-  cmd[1] = strdup("-x");
-  cmd[2] = strdup("0.2910234");
-  cmd[3] = strdup("-y");
-  cmd[4] = strdup("-0.0164365");
-  cmd[5] = strdup("-s");
-  cmd[6] = strdup(s_str);
-  cmd[7] = strdup("-m");
-  cmd[8] = strdup("4000");
-  cmd[9] = strdup("-W");
-  cmd[10] = strdup("700");
-  cmd[11] = strdup("-H");
-  cmd[12] = strdup("700");
-  cmd[13] = strdup("-o");
-  cmd[14] = strdup(filename);
-  cmd[15] = strdup("-n");
-  cmd[16] = strdup("1");
-  cmd[17] = NULL;
-  cmd[17] = NULL;
+    // Top up the frames in flight
+    for (; next < num_frames && next < i + window; next++) {
+      struct slot *s = &slots[next % window];
+      if (interval) {
+        // Resampling needs the whole keyframe, which may not even be started yet
+        if (next/interval >= key_next) break;
+        struct keyslot *k = &keys[(next/interval) % 2];
+        if (k->f) {
+          render_wait(r, k->f);
+          points += atomic_load(&k->f->computed);
+          frame_delete(k->f);
+          k->f = NULL;
+        }
+        params.key = &k->key;
+      }
+      params.scale = start * pow(base, next);
+      params.arg = s;
+      if (!(s->f = render_submit(r, s->bm, &params))) {
+        fprintf(stderr, "mandelmovie: couldn't set up frame %d: %s\n", next + 1, strerror(errno));
+        return EXIT_FAILURE;
+      }
+    }
+
+    // Write frames in order; later ones may already be finished and encoded
+    struct slot *s = &slots[i % window];
+    render_wait(r, s->f);
+    points += atomic_load(&s->f->computed);
+    frame_delete(s->f);
+    if (!video_write(v, s->bm, s->buf)) {
+      fprintf(stderr, "mandelmovie: couldn't write frame %d to %s: %s\n", i + 1, output, strerror(errno));
+      status = EXIT_FAILURE;
+      break;
+    }
+  }
+
+  // Finish any frames still in flight after an error before tearing down
+  for (; i + 1 < next; i++) {
+    render_wait(r, slots[(i + 1) % window].f);
+    frame_delete(slots[(i + 1) % window].f);
+  }
+  for (i = 0; i < 2 && interval; i++) {
+    if (keys[i].f) {
+      render_wait(r, keys[i].f);
+      frame_delete(keys[i].f);
+    }
+    bitmap_delete(keys[i].key.bm);
+  }
+  render_delete(r);
+  fprintf(stderr, "mandelmovie: computed %ld points for %d frames\n", points, num_frames);
+  if (!video_close(v)) {
+    fprintf(stderr, "mandelmovie: couldn't write to %s: %s\n", output, strerror(errno));
+    status = EXIT_FAILURE;
+  }
+  for (i = 0; i < window; i++) {
+    bitmap_delete(slots[i].bm);
+    free(slots[i].buf);
+  }
+  return status;
 }
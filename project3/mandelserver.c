@@ -0,0 +1,252 @@
+// mandelserver.c
+// Ann Keenan (akeenan2)
+//
+// Long-running render service for exploring the set interactively. Clients
+// send text requests over a ZeroMQ REQ socket and get back each tile as the
+// bytes of a BMP file. Tiles are rendered on a persistent thread pool and
+// cached in memory and on disk, so panning back over a view or reopening it
+// later costs a lookup instead of a render.
+
+#include "bignum.h"
+#include "bitmap.h"
+#include "kernel.h"
+#include "render.h"
+#include "tilecache.h"
+
+#include <errno.h>
+#include <getopt.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <zmq.h>
+
+#define MAX_THREADS 256
+#define MIN_TILE 16
+#define MAX_TILE 2048
+#define MAXBUF 1024
+
+const char *PORT = "6600";
+
+// Set up the ZMQ socket
+void *context;
+void *responder;
+
+void show_help() {
+  printf("Use: mandelserver [options]\n");
+  printf("Where options are:\n");
+  printf("-P <port>    Port to listen on, on the local host. (default=%s)\n", PORT);
+  printf("-n <threads> The number of render threads. (default=number of CPUs)\n");
+  printf("-c <dir>     Directory of the on-disk tile cache. (default=tiles)\n");
+  printf("-C <tiles>   Number of tiles kept in memory. (default=1024)\n");
+  printf("-k <kernel>  Iteration kernel: auto, scalar, sse2, avx2 or avx512. (default=auto)\n");
+  printf("-p <prec>    Arithmetic: auto, float, double, dd or perturb. (default=auto)\n");
+  printf("-h           Show this help text.\n");
+  printf("\nRequests are:\n");
+  printf("tile <x> <y> <scale> <max> <size> <tx> <ty>\n");
+  printf("    The size x size tile (tx, ty) of the grid centered on (x, y) whose tiles\n");
+  printf("    are scale on either side of their centers, as with mandel -s. Replies with\n");
+  printf("    a BMP file, or a line starting with Error.\n");
+  printf("stats\n");
+  printf("    Cache hits in memory and on disk, misses and time spent rendering.\n\n");
+}
+
+void sigint_handler(int signum) {
+  printf("Exiting...\n");
+  zmq_close(responder);
+  zmq_ctx_destroy(context);
+  _exit(signum);
+}
+
+static double now() {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec*1e-9;
+}
+
+struct server {
+  struct renderer *r;
+  struct tile_cache *cache;
+  struct bitmap *bm;
+  int kernel;
+  int precision;
+  double render_time;
+};
+
+static void reply_error(const char *message) {
+  char buf[MAXBUF];
+  int n = snprintf(buf, sizeof(buf), "Error: %s\n", message);
+  zmq_send(responder, buf, n, 0);
+}
+
+// Center of tile (tx, ty) of the grid around (x, y), exactly, as a decimal
+// string. Tiles are 2*scale apart, so deep zoom grids keep every digit.
+static int tile_center(const char *c, double scale, long t, char *out, int size) {
+  struct bignum center, offset, sum;
+  int limbs = bignum_limbs_for(scale);
+  if (!bignum_parse(&center, c, limbs)) return 0;
+  bignum_from_double(&offset, 2*scale*t, limbs);
+  bignum_add(&sum, &center, &offset);
+  bignum_format(&sum, out, size);
+  return 1;
+}
+
+static void serve_tile(struct server *s, char *args) {
+  char x[BIGNUM_CHARS], y[BIGNUM_CHARS], cx[BIGNUM_CHARS], cy[BIGNUM_CHARS];
+  double scale;
+  int max, size;
+  long tx, ty;
+  if (sscanf(args, "%319s %319s %lf %d %d %ld %ld", x, y, &scale, &max, &size, &tx, &ty) != 7) {
+    reply_error("usage: tile <x> <y> <scale> <max> <size> <tx> <ty>");
+    return;
+  }
+  if (scale <= 0 || max < 1 || size < MIN_TILE || size > MAX_TILE) {
+    reply_error("scale and max must be positive and size between 16 and 2048");
+    return;
+  }
+  if (!tile_center(x, scale, tx, cx, sizeof(cx)) || !tile_center(y, scale, ty, cy, sizeof(cy))) {
+    reply_error("couldn't parse the center");
+    return;
+  }
+
+  // The key holds everything that determines the pixels, with the center in a
+  // canonical form so that equal views spelled differently share their tiles
+  char key[MAXBUF];
+  snprintf(key, sizeof(key), "%s %s %.17g %d %d %s", cx, cy, scale, max, size, precision_name(s->precision));
+
+  double start = now();
+  struct cache_entry *e = tile_cache_get(s->cache, key);
+  const char *how = "cached";
+  if (!e) {
+    if (!s->bm || bitmap_width(s->bm) != size) {
+      if (s->bm) bitmap_delete(s->bm);
+      if (!(s->bm = bitmap_create(size, size))) {
+        reply_error("couldn't allocate the tile");
+        return;
+      }
+    }
+    struct render_params params = {
+      .x = cx, .y = cy, .scale = scale, .max = max,
+      .kernel = s->kernel, .mode = RENDER_FULL, .tile_size = DEFAULT_TILE_SIZE, .precision = s->precision,
+    };
+    struct frame *f = render_submit(s->r, s->bm, &params);
+    if (!f) {
+      reply_error(strerror(errno));
+      return;
+    }
+    render_wait(s->r, f);
+    how = precision_name(f->precision);
+    frame_delete(f);
+    s->render_time += now() - start;
+
+    if (!(e = tile_cache_put(s->cache, key, s->bm))) {
+      reply_error(strerror(errno));
+      return;
+    }
+  }
+  zmq_send(responder, e->data, e->size, 0);
+  printf("tile %ld %ld of %s %s scale=%g max=%d: %s in %.1f ms\n", tx, ty, x, y, scale, max, how, (now() - start)*1000);
+}
+
+static void serve_stats(struct server *s) {
+  char buf[MAXBUF];
+  int n = snprintf(buf, sizeof(buf), "%ld memory hits, %ld disk hits, %ld misses, %.3f s rendering\n",
+                   s->cache->hits, s->cache->disk_hits, s->cache->misses, s->render_time);
+  zmq_send(responder, buf, n, 0);
+}
+
+int main(int argc, char *argv[]) {
+  int c;
+  int num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+  const char *dir = "tiles";
+  int capacity = 1024;
+  struct server s = {NULL, NULL, NULL, KERNEL_AUTO, PRECISION_AUTO, 0};
+
+  while ((c = getopt(argc, argv, "P:n:c:C:k:p:h")) != -1) {
+    switch(c) {
+      case 'P':
+        PORT = optarg;
+        break;
+      case 'n':
+        num_threads = atoi(optarg);
+        break;
+      case 'c':
+        dir = optarg;
+        break;
+      case 'C':
+        capacity = atoi(optarg);
+        break;
+      case 'k':
+        if ((s.kernel = kernel_parse(optarg)) == -1) {
+          printf("Unknown kernel '%s'.\nDefaulting to auto.\n", optarg);
+          s.kernel = KERNEL_AUTO;
+        }
+        break;
+      case 'p':
+        if ((s.precision = precision_parse(optarg)) == -1) {
+          printf("Unknown precision '%s'.\nDefaulting to auto.\n", optarg);
+          s.precision = PRECISION_AUTO;
+        }
+        break;
+      case 'h':
+      default:
+        show_help();
+        return EXIT_FAILURE;
+    }
+  }
+  if (num_threads < 1 || num_threads > MAX_THREADS || capacity < 1) {
+    fprintf(stderr, "ERROR: Threads must be between 1 and %d and the memory cache hold at least 1 tile.\n", MAX_THREADS);
+    return EXIT_FAILURE;
+  }
+  s.kernel = kernel_resolve(s.kernel);
+
+  if (!(s.cache = tile_cache_create(dir, capacity))) {
+    fprintf(stderr, "mandelserver: couldn't create the tile cache in %s: %s\n", dir, strerror(errno));
+    return EXIT_FAILURE;
+  }
+  if (!(s.r = render_create(num_threads))) {
+    fprintf(stderr, "mandelserver: couldn't start %d threads: %s\n", num_threads, strerror(errno));
+    return EXIT_FAILURE;
+  }
+
+  char addr[MAXBUF];
+  snprintf(addr, sizeof(addr), "tcp://127.0.0.1:%s", PORT);
+  context = zmq_ctx_new();
+  responder = zmq_socket(context, ZMQ_REP);
+  if (zmq_bind(responder, addr) == -1) {
+    fprintf(stderr, "mandelserver: couldn't bind to %s: %s\n", addr, zmq_strerror(errno));
+    return EXIT_FAILURE;
+  }
+  signal(SIGINT, sigint_handler);
+  printf("Starting mandelserver on port %s with %d threads, caching tiles in %s...\n", PORT, num_threads, dir);
+
+  // A REP socket takes one request at a time; the pool renders each tile
+  char request[MAXBUF];
+  while (1) {
+    int n = zmq_recv(responder, request, sizeof(request) - 1, 0);
+    if (n == -1) {
+      if (errno == EINTR) continue;
+      fprintf(stderr, "mandelserver: receive failed: %s\n", zmq_strerror(errno));
+      break;
+    }
+    request[n < (int) sizeof(request) - 1 ? n : (int) sizeof(request) - 1] = 0;
+
+    if (strncmp(request, "tile ", 5) == 0) {
+      serve_tile(&s, request + 5);
+    } else if (strcmp(request, "stats") == 0) {
+      serve_stats(&s);
+    } else {
+      reply_error("unknown request, expected tile or stats");
+    }
+    fflush(stdout);
+  }
+
+  zmq_close(responder);
+  zmq_ctx_destroy(context);
+  render_delete(s.r);
+  tile_cache_delete(s.cache);
+  if (s.bm) bitmap_delete(s.bm);
+  return EXIT_FAILURE;
+}
@@ -0,0 +1,156 @@
+// perturb.c
+// Ann Keenan (akeenan2)
+//
+// Deep zoom by perturbation. A single reference orbit Z_n is computed at the
+// image center with bignum arithmetic, and every pixel c = C + dc is iterated
+// only as its small difference from that orbit,
+//   dz_{n+1} = 2 Z_n dz_n + dz_n^2 + dc,
+// which stays accurate in double precision however deep the zoom is.
+//
+// A pixel whose orbit strays from the reference (|Z_n + dz_n| < |dz_n|, the
+// usual source of glitches) or outlives it is rebased: its full value becomes
+// the new delta against Z_0 = 0 and it continues from the start of the orbit.
+//
+// The first iterations of every pixel are skipped with the series
+//   dz_n ~ A_n dc + B_n dc^2 + C_n dc^3,
+// evaluated once per pixel, for as long as the omitted quartic term stays negligible.
+
+#include "perturb.h"
+#include "bignum.h"
+
+#include <math.h>
+#include <stdlib.h>
+
+// Largest allowed size of the series' first omitted term relative to its linear term
+#define SERIES_TOLERANCE 1e-12
+
+// Compute the reference orbit at (xcenter, ycenter), given as decimal strings so
+// that no digits are lost, for an image of the given scale. Returns NULL if the
+// center cannot be parsed or memory runs out.
+struct orbit *orbit_create(const char *xcenter, const char *ycenter, double scale, int max) {
+  int limbs = bignum_limbs_for(scale);
+  struct bignum cx, cy, x, y, xx, yy, xy, t;
+  if (!bignum_parse(&cx, xcenter, limbs) || !bignum_parse(&cy, ycenter, limbs)) {
+    return NULL;
+  }
+
+  struct orbit *o = malloc(sizeof(*o));
+  if (!o) return NULL;
+  o->zx = malloc((max + 2)*sizeof(double));
+  o->zy = malloc((max + 2)*sizeof(double));
+  if (!o->zx || !o->zy) {
+    orbit_delete(o);
+    return NULL;
+  }
+
+  // Z_0 = 0, Z_{n+1} = Z_n^2 + C, up to Z_max or until the reference escapes
+  bignum_zero(&x, limbs);
+  bignum_zero(&y, limbs);
+  int n;
+  for (n = 0; n <= max; n++) {
+    double zx = bignum_to_double(&x);
+    double zy = bignum_to_double(&y);
+    o->zx[n] = zx;
+    o->zy[n] = zy;
+    if (zx*zx + zy*zy > 4) {
+      n++;
+      break;
+    }
+
+    bignum_mul(&xx, &x, &x);
+    bignum_mul(&yy, &y, &y);
+    bignum_mul(&xy, &x, &y);
+    bignum_sub(&t, &xx, &yy);
+    bignum_add(&x, &t, &cx);
+    bignum_add(&t, &xy, &xy);
+    bignum_add(&y, &t, &cy);
+  }
+  o->len = n;
+
+  // Series coefficients start from dz_1 = dc, i.e. A_1 = 1 and B_1 = C_1 = 0.
+  // The fourth order coefficient D is not used, only tracked to bound the error.
+  double d = scale*sqrt(2);
+  double ax = 1, ay = 0, bx = 0, by = 0, ccx = 0, ccy = 0, dx = 0, dy = 0;
+  o->skip = 1;
+  o->ax = ax; o->ay = ay;
+  o->bx = bx; o->by = by;
+  o->cx = ccx; o->cy = ccy;
+  for (n = 1; n < o->len - 1 && n < max; n++) {
+    double zx = o->zx[n], zy = o->zy[n];
+    double ndx = 2*(zx*dx - zy*dy) + 2*(ax*ccx - ay*ccy) + bx*bx - by*by;
+    double ndy = 2*(zx*dy + zy*dx) + 2*(ax*ccy + ay*ccx) + 2*bx*by;
+    double ncx = 2*(zx*ccx - zy*ccy) + 2*(ax*bx - ay*by);
+    double ncy = 2*(zx*ccy + zy*ccx) + 2*(ax*by + ay*bx);
+    double nbx = 2*(zx*bx - zy*by) + ax*ax - ay*ay;
+    double nby = 2*(zx*by + zy*bx) + 2*ax*ay;
+    double nax = 2*(zx*ax - zy*ay) + 1;
+    double nay = 2*(zx*ay + zy*ax);
+    ax = nax; ay = nay;
+    bx = nbx; by = nby;
+    ccx = ncx; ccy = ncy;
+    dx = ndx; dy = ndy;
+
+    // Stop once the first truncated term could be noticed
+    double err = hypot(dx, dy)*d*d*d*d;
+    if (!isfinite(err) || err > SERIES_TOLERANCE*hypot(ax, ay)*d) break;
+    o->skip = n + 1;
+    o->ax = ax; o->ay = ay;
+    o->bx = bx; o->by = by;
+    o->cx = ccx; o->cy = ccy;
+  }
+  return o;
+}
+
+void orbit_delete(struct orbit *o) {
+  free(o->zx);
+  free(o->zy);
+  free(o);
+}
+
+// Compute the iterations of n points given as offsets (dcx[i], dcy[i]) from the
+// reference orbit's center, up to a maximum of max.
+void perturb_points(const struct orbit *o, const double *dcx, const double *dcy, int n, int max, int *iters) {
+  int i;
+  for (i = 0; i < n; i++) {
+    double cx = dcx[i], cy = dcy[i];
+
+    // Start from the series approximation of dz_skip
+    double c2x = cx*cx - cy*cy, c2y = 2*cx*cy;
+    double c3x = c2x*cx - c2y*cy, c3y = c2x*cy + c2y*cx;
+    double dx = o->ax*cx - o->ay*cy + o->bx*c2x - o->by*c2y + o->cx*c3x - o->cy*c3y;
+    double dy = o->ax*cy + o->ay*cx + o->bx*c2y + o->by*c2x + o->cx*c3y + o->cy*c3x;
+    int m = o->skip;
+    int iter = o->skip - 1;
+
+    // A point that escaped within the skipped iterations is redone from dz_1 = dc
+    if (m > 1 && (o->zx[m] + dx)*(o->zx[m] + dx) + (o->zy[m] + dy)*(o->zy[m] + dy) > 4) {
+      dx = cx;
+      dy = cy;
+      m = 1;
+      iter = 0;
+    }
+
+    while (iter < max) {
+      double zx = o->zx[m] + dx;
+      double zy = o->zy[m] + dy;
+      double r2 = zx*zx + zy*zy;
+      if (r2 > 4) break;
+
+      // Rebase when the point has drifted away from the reference or run past its end
+      if (r2 < dx*dx + dy*dy || m == o->len - 1) {
+        dx = zx;
+        dy = zy;
+        m = 0;
+      }
+
+      double rx = o->zx[m], ry = o->zy[m];
+      double nx = 2*(rx*dx - ry*dy) + dx*dx - dy*dy + cx;
+      double ny = 2*(rx*dy + ry*dx) + 2*dx*dy + cy;
+      dx = nx;
+      dy = ny;
+      m++;
+      iter++;
+    }
+    iters[i] = iter;
+  }
+}
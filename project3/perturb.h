@@ -0,0 +1,23 @@
+// perturb.h
+// Ann Keenan (akeenan2)
+
+#ifndef PERTURB_H
+#define PERTURB_H
+
+// High-precision reference orbit Z_n of the image center, stored as doubles,
+// together with the series approximation used to skip its first iterations.
+struct orbit {
+  int len;          // number of stored points Z_0..Z_{len-1}
+  double *zx;
+  double *zy;
+  int skip;         // iterations covered by the series approximation
+  double ax, ay;    // series coefficients A, B and C at iteration skip
+  double bx, by;
+  double cx, cy;
+};
+
+struct orbit *orbit_create(const char *xcenter, const char *ycenter, double scale, int max);
+void          orbit_delete(struct orbit *o);
+void          perturb_points(const struct orbit *o, const double *dcx, const double *dcy, int n, int max, int *iters);
+
+#endif
@@ -0,0 +1,766 @@
+// render.c
+// Ann Keenan (akeenan2)
+//
+// Persistent render pool. Frames are queued in submission order and workers
+// always claim the next tile of the oldest frame that still has tiles left, so
+// one scheduler covers both the tiles of a frame and the frames of a movie and
+// every thread stays busy until the last tile of the last frame.
+
+#include "render.h"
+#include "bignum.h"
+#include "resample.h"
+
+#include <errno.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Rectangles smaller than this are computed in full rather than split again
+#define MIN_SUBDIVIDE 16
+
+// Bits of a precision's mantissa kept spare below the pixel spacing, on top of
+// log2(max) for the rounding error that builds up over max iterations
+#define PRECISION_GUARD_BITS 4
+
+// Mantissa bits of float, double and double-double
+static const int precisionBits[] = {0, 24, 53, 106};
+
+// Per-thread point buffers for the kernel
+struct worker {
+  struct renderer *r;
+  int id;
+  int capacity;
+  double *cx;
+  double *cy;
+  int *out;
+  long *idx;            // columns, or pixel numbers in subdivide mode
+};
+
+static void *render_worker(void *args);
+static int   schedule_tiles(struct frame *f);
+
+// Pick the cheapest precision that still tells neighbouring pixels apart. Orbit
+// values are up to 2 in magnitude, and pixels are 2*scale/size apart, so about
+// log2(size/scale) bits are needed, plus guard bits for rounding in the iteration.
+// Float is never picked: near the boundary its rounding error grows chaotically
+// along the orbit rather than by log2(max) bits, and it changes hundreds of
+// pixels even of the default view. It is only used when asked for with -p float.
+static int precision_for(double scale, int width, int height, int max) {
+  int size = width > height ? width : height;
+  double bits = log2(size/scale) + log2(max) + PRECISION_GUARD_BITS;
+  int p;
+  for (p = PRECISION_DOUBLE; p <= PRECISION_DD; p++) {
+    if (bits <= precisionBits[p]) return p;
+  }
+  return PRECISION_PERTURB;
+}
+
+// Start a pool of num_threads workers. Returns NULL if a thread can't be created.
+struct renderer *render_create(int num_threads) {
+  struct renderer *r = malloc(sizeof(*r));
+  if (!r) return NULL;
+
+  pthread_mutex_init(&r->lock, NULL);
+  pthread_cond_init(&r->work, NULL);
+  pthread_cond_init(&r->finished, NULL);
+  r->head = r->tail = NULL;
+  r->shutdown = 0;
+  r->num_threads = num_threads;
+  r->threads = malloc(num_threads*sizeof(pthread_t));
+  r->stats = calloc(num_threads, sizeof(struct worker_stats));
+  if (!r->threads || !r->stats) {
+    free(r->threads);
+    free(r->stats);
+    free(r);
+    return NULL;
+  }
+
+  int i, rc;
+  for (i = 0; i < num_threads; i++) {
+    struct worker *w = calloc(1, sizeof(*w));
+    if (!w) {
+      fprintf(stderr, "ERROR: Unable to allocate worker %d.\n", i);
+      exit(EXIT_FAILURE);
+    }
+    w->r = r;
+    w->id = i;
+    if ((rc = pthread_create(&r->threads[i], NULL, render_worker, w)) != 0) {
+      printf("ERROR: Unable to create thread %d with exit code %d.", i, rc);
+      exit(EXIT_FAILURE);
+    }
+  }
+  return r;
+}
+
+// Stop the workers once every submitted frame is finished
+void render_delete(struct renderer *r) {
+  int i, rc;
+  pthread_mutex_lock(&r->lock);
+  r->shutdown = 1;
+  pthread_cond_broadcast(&r->work);
+  pthread_mutex_unlock(&r->lock);
+
+  for (i = 0; i < r->num_threads; i++) {
+    if ((rc = pthread_join(r->threads[i], NULL)) != 0) {
+      printf("ERROR: Unable to join thread %d with exit code %d.", i, rc);
+      exit(EXIT_FAILURE);
+    }
+  }
+  pthread_cond_destroy(&r->finished);
+  pthread_cond_destroy(&r->work);
+  pthread_mutex_destroy(&r->lock);
+  free(r->threads);
+  free(r->stats);
+  free(r);
+}
+
+// Queue the rendering of p into bm. Returns NULL, with errno set where it
+// applies, if the frame can't be set up.
+struct frame *render_submit(struct renderer *r, struct bitmap *bm, const struct render_params *p) {
+  struct frame *f = calloc(1, sizeof(*f));
+  if (!f) return NULL;
+
+  int width = bitmap_width(bm);
+  int height = bitmap_height(bm);
+  double xcenter = atof(p->x);
+  double ycenter = atof(p->y);
+
+  // Julia and Multibrot sets have no double-double or perturbation kernels
+  int classic = !kernel_get_family(p->kernel, p->fractal, 0);
+  f->precision = p->precision;
+  if (!classic && f->precision > PRECISION_DOUBLE) f->precision = PRECISION_DOUBLE;
+  if (f->precision == PRECISION_AUTO) {
+    f->precision = precision_for(p->scale, width, height, p->max);
+    if (!classic && f->precision > PRECISION_DOUBLE) f->precision = PRECISION_DOUBLE;
+
+    // Double-double and perturbation cost about the same per iteration, but
+    // perturbation wins outright when its series skips most of the iterations
+    if (f->precision == PRECISION_DD) {
+      struct orbit *o = orbit_create(p->x, p->y, p->scale, p->max);
+      if (o && 2*(o->skip - 1) >= p->max) {
+        f->orbit = o;
+        f->precision = PRECISION_PERTURB;
+      } else if (o) {
+        orbit_delete(o);
+      }
+    }
+  }
+
+  if (f->precision == PRECISION_DD) {
+    // Parse the center to 128 fraction bits and round it to double-doubles
+    struct bignum x, y;
+    if (!bignum_parse(&x, p->x, 5) || !bignum_parse(&y, p->y, 5)) {
+      errno = EINVAL;
+      free(f);
+      return NULL;
+    }
+    bignum_to_dd(&x, &f->center[0], &f->center[1]);
+    bignum_to_dd(&y, &f->center[2], &f->center[3]);
+    xcenter = ycenter = 0;
+  } else if (f->precision == PRECISION_PERTURB) {
+    // Compute the reference orbit for zooms that no fixed precision resolves
+    if (!f->orbit && !(f->orbit = orbit_create(p->x, p->y, p->scale, p->max))) {
+      errno = EINVAL;
+      free(f);
+      return NULL;
+    }
+    xcenter = ycenter = 0;
+  }
+
+  // Antialiasing resamples pixels whose color differs from a neighbour's
+  f->grid = 1;
+  while ((f->grid + 1)*(f->grid + 1) <= p->samples) f->grid++;
+  f->threshold = p->threshold;
+  f->pass = PASS_RENDER;
+  if (p->key && p->mode == RENDER_FULL) {
+    f->key = *p->key;
+    f->grid = 1;
+  }
+  f->coarsest = f->stride = p->progressive && p->mode == RENDER_FULL && !f->key.bm ? PROGRESSIVE_STRIDE : 1;
+
+  // Subdivision compares iteration counts, and antialiasing the colors they
+  // give, so keep them for the whole image
+  if (p->mode == RENDER_SUBDIVIDE || f->grid > 1) {
+    if (!(f->iters = malloc((long) width*height*sizeof(int)))) {
+      frame_delete(f);
+      return NULL;
+    }
+  }
+
+  f->bm = bm;
+  f->max = p->max;
+  f->xmin = xcenter - p->scale;
+  f->xmax = xcenter + p->scale;
+  f->ymin = ycenter - p->scale;
+  f->ymax = ycenter + p->scale;
+  f->kernel = f->precision == PRECISION_FLOAT ? kernel_get_float(p->kernel) : kernel_get(p->kernel);
+  f->dd_kernel = kernel_get_dd(p->kernel);
+  f->family = kernel_get_family(p->kernel, p->fractal, f->precision == PRECISION_FLOAT);
+  if (f->family) {
+    f->k[0] = p->fractal->kx;
+    f->k[1] = p->fractal->ky;
+  }
+  f->mode = p->mode;
+  f->finish = p->finish;
+  f->progress = p->progress;
+  f->arg = p->arg;
+  tile_queue_init(&f->tiles, width, height, p->tile_size);
+  if (!(f->tile_time = calloc(f->tiles.count ? f->tiles.count : 1, sizeof(double))) || !schedule_tiles(f)) {
+    frame_delete(f);
+    return NULL;
+  }
+  f->pending = f->tiles.count;
+  atomic_init(&f->computed, 0);
+  atomic_init(&f->resampled, 0);
+
+  pthread_mutex_lock(&r->lock);
+  if (!f->pending) {
+    pthread_mutex_unlock(&r->lock);
+    if (f->finish) f->finish(f, f->arg);
+    f->done = 1;
+    return f;
+  }
+  if (r->tail) {
+    r->tail->next = f;
+  } else {
+    r->head = f;
+  }
+  r->tail = f;
+  pthread_cond_broadcast(&r->work);
+  pthread_mutex_unlock(&r->lock);
+  return f;
+}
+
+// Block until every tile of f has been rendered
+void render_wait(struct renderer *r, struct frame *f) {
+  pthread_mutex_lock(&r->lock);
+  while (!f->done) {
+    pthread_cond_wait(&r->finished, &r->lock);
+  }
+  pthread_mutex_unlock(&r->lock);
+}
+
+void frame_delete(struct frame *f) {
+  if (f->orbit) orbit_delete(f->orbit);
+  free(f->iters);
+  free(f->order);
+  free(f->tile_time);
+  free(f);
+}
+
+// Iterate n points in the frame's arithmetic
+static void iterate_points(struct frame *f, const double *cx, const double *cy, int n, int *out) {
+  if (f->family) {
+    f->family(f->k, cx, cy, n, f->max, out);
+  } else if (f->orbit) {
+    perturb_points(f->orbit, cx, cy, n, f->max, out);
+  } else if (f->precision == PRECISION_DD) {
+    f->dd_kernel(f->center, cx, cy, n, f->max, out);
+  } else {
+    f->kernel(cx, cy, n, f->max, out);
+  }
+}
+
+struct tile_cost {
+  int cost;
+  int tile;
+};
+
+// Most expensive first, and in row order among equals
+static int by_cost(const void *a, const void *b) {
+  const struct tile_cost *x = a, *y = b;
+  if (x->cost != y->cost) return x->cost < y->cost ? 1 : -1;
+  return x->tile - y->tile;
+}
+
+// Order the frame's tiles by the iterations of the point at their centers, so
+// that the most expensive ones are claimed first and the frame ends on cheap
+// ones instead of on whichever costly tile happened to be last. The probe is
+// one point per tile, about a thousandth of the frame at the default tile size.
+// Returns 0 if out of memory.
+static int schedule_tiles(struct frame *f) {
+  struct tile_queue *q = &f->tiles;
+  int n = q->count;
+  double *cx = malloc(n*sizeof(double));
+  double *cy = malloc(n*sizeof(double));
+  int *out = malloc(n*sizeof(int));
+  struct tile_cost *costs = malloc(n*sizeof(struct tile_cost));
+  f->order = malloc(n*sizeof(int));
+  if (!cx || !cy || !out || !costs || !f->order) {
+    free(cx);
+    free(cy);
+    free(out);
+    free(costs);
+    return 0;
+  }
+
+  int i;
+  for (i = 0; i < n; i++) {
+    double x = (i % q->cols)*q->size + q->size/2.0;
+    double y = (i / q->cols)*q->size + q->size/2.0;
+    if (x > q->width) x = q->width;
+    if (y > q->height) y = q->height;
+    cx[i] = f->xmin + x*(f->xmax - f->xmin)/q->width;
+    cy[i] = f->ymin + y*(f->ymax - f->ymin)/q->height;
+  }
+  iterate_points(f, cx, cy, n, out);
+
+  for (i = 0; i < n; i++) {
+    costs[i].cost = out[i];
+    costs[i].tile = i;
+  }
+  qsort(costs, n, sizeof(struct tile_cost), by_cost);
+  for (i = 0; i < n; i++) {
+    f->order[i] = costs[i].tile;
+  }
+  tile_queue_set_order(q, f->order);
+
+  free(cx);
+  free(cy);
+  free(out);
+  free(costs);
+  return 1;
+}
+
+// Make sure the worker's buffers hold a whole tile of the given size plus its
+// border, or a row of it with every pixel antialiased
+static void worker_reserve(struct worker *w, int size, int grid) {
+  int n = size*size + 4*size;
+  if (size*grid*grid > n) n = size*grid*grid;
+  if (n <= w->capacity) return;
+
+  free(w->cx);
+  free(w->cy);
+  free(w->out);
+  free(w->idx);
+  w->cx = malloc(n*sizeof(double));
+  w->cy = malloc(n*sizeof(double));
+  w->out = malloc(n*sizeof(int));
+  w->idx = malloc(n*sizeof(long));
+  if (!w->cx || !w->cy || !w->out || !w->idx) {
+    fprintf(stderr, "ERROR: Unable to allocate point buffers for thread %d.\n", w->id);
+    exit(EXIT_FAILURE);
+  }
+  w->capacity = n;
+}
+
+static double now() {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec*1e-9;
+}
+
+// Compute the iterations of the first n points in the worker's point buffers
+static void compute_points(struct frame *f, struct worker *w, int n) {
+  iterate_points(f, w->cx, w->cy, n, w->out);
+  atomic_fetch_add_explicit(&f->computed, n, memory_order_relaxed);
+
+  long total = 0;
+  int i;
+  for (i = 0; i < n; i++) {
+    total += w->out[i];
+  }
+  w->r->stats[w->id].iterations += total;
+}
+
+// Compute the pixels of a tile on the current pass's lattice, one row at a
+// time. Pixels already computed by a coarser pass are skipped, and each new one
+// is drawn as a stride x stride block until finer passes fill the block in.
+static void compute_tile(struct frame *f, struct worker *w, struct tile *t) {
+  struct bitmap *bm = f->bm;
+  int width = bitmap_width(bm);
+  int height = bitmap_height(bm);
+  int s = f->stride;
+  int x0 = (t->x0 + s - 1)/s*s;
+  int i, j, x, y, n;
+
+  for (j = (t->y0 + s - 1)/s*s; j < t->y1; j += s) {
+    // Rows of the previous pass already hold every other point
+    int skip = s < f->coarsest && j % (2*s) == 0;
+    n = 0;
+    for (x = x0; x < t->x1; x += s) {
+      if (skip && x % (2*s) == 0) continue;
+
+      // Determine the point in x, y space for that pixel.
+      w->cx[n] = f->xmin + x*(f->xmax - f->xmin)/width;
+      w->cy[n] = f->ymin + j*(f->ymax - f->ymin)/height;
+      w->idx[n++] = x;
+    }
+
+    // Compute the iterations at every point of the tile row.
+    compute_points(f, w, n);
+
+    // Keep the iterations for antialiasing
+    if (f->iters) {
+      for (i = 0; i < n; i++) {
+        f->iters[(long) j*width + w->idx[i]] = w->out[i];
+      }
+    }
+
+    for (i = 0; i < n; i++) {
+      w->out[i] = iteration_to_color(w->out[i], f->max);
+    }
+    if (s == 1) {
+      // Set the pixels in the bitmap, a whole tile row at once.
+      if (n == t->x1 - t->x0) {
+        bitmap_set_span(bm, t->x0, j, w->out, n);
+      } else {
+        int *row = bitmap_row(bm, j);
+        for (i = 0; i < n; i++) row[w->idx[i]] = w->out[i];
+      }
+      continue;
+    }
+    for (y = j; y < j + s && y < t->y1; y++) {
+      int *row = bitmap_row(bm, y);
+      for (i = 0; i < n; i++) {
+        for (x = w->idx[i]; x < w->idx[i] + s && x < t->x1; x++) row[x] = w->out[i];
+      }
+    }
+  }
+}
+
+// Derive a tile from the keyframe by bilinear resampling. Pixels whose four
+// source pixels differ by more than the threshold straddle detail the keyframe
+// does not resolve at this zoom, so they are computed exactly instead.
+static void resample_tile(struct frame *f, struct worker *w, struct tile *t) {
+  struct bitmap *key = f->key.bm;
+  int width = bitmap_width(f->bm);
+  int height = bitmap_height(f->bm);
+  int n = t->x1 - t->x0;
+  int i, j, k;
+
+  // Frame pixel i lies at -scale + i*2*scale/width from the shared center,
+  // which is keyframe pixel (that + kscale)*kwidth/(2*kscale)
+  double scale = (f->xmax - f->xmin)/2;
+  double kscale = f->key.scale;
+  double du = scale/kscale*bitmap_width(key)/width;
+  double dv = scale/kscale*bitmap_height(key)/height;
+  double u0 = (kscale - scale)*bitmap_width(key)/(2*kscale);
+  double v0 = (kscale - scale)*bitmap_height(key)/(2*kscale);
+
+  for (j = t->y0; j < t->y1; j++) {
+    int *row = bitmap_row(f->bm, j);
+    resample_row(key, u0 + t->x0*du, du, v0 + j*dv, n, row + t->x0, w->out);
+
+    // Queue the unreliable pixels by their spread in out, compacting their
+    // columns into idx
+    k = 0;
+    for (i = 0; i < n; i++) {
+      if (w->out[i] <= f->threshold) continue;
+      w->idx[k] = t->x0 + i;
+      w->cx[k] = f->xmin + (t->x0 + i)*(f->xmax - f->xmin)/width;
+      w->cy[k] = f->ymin + j*(f->ymax - f->ymin)/height;
+      k++;
+    }
+    if (!k) continue;
+    compute_points(f, w, k);
+    for (i = 0; i < k; i++) {
+      row[w->idx[i]] = iteration_to_color(w->out[i], f->max);
+    }
+  }
+}
+
+// Queue pixel (x, y) for the kernel unless it is already computed or queued
+static void queue_point(struct frame *f, struct worker *w, int x, int y, int *n) {
+  int width = bitmap_width(f->bm);
+  int height = bitmap_height(f->bm);
+  long k = (long) y*width + x;
+
+  if (f->iters[k] != -1) return;
+  f->iters[k] = -2;
+  w->cx[*n] = f->xmin + x*(f->xmax - f->xmin)/width;
+  w->cy[*n] = f->ymin + y*(f->ymax - f->ymin)/height;
+  w->idx[*n] = k;
+  (*n)++;
+}
+
+// Run the kernel over every queued point and store the results
+static void flush_points(struct frame *f, struct worker *w, int n) {
+  int i;
+  compute_points(f, w, n);
+  for (i = 0; i < n; i++) {
+    f->iters[w->idx[i]] = w->out[i];
+  }
+}
+
+// Mariani-Silver: compute the border of the inclusive rectangle (x0, y0)-(x1, y1).
+// If the whole border has one iteration count the interior is filled with it,
+// otherwise the rectangle is split in four and each quarter is handled the same way.
+static void subdivide(struct frame *f, struct worker *w, int x0, int y0, int x1, int y1) {
+  int width = bitmap_width(f->bm);
+  int *iters = f->iters;
+  int i, j, n = 0;
+
+  // Queue each edge separately so neighbouring kernel lanes hold neighbouring pixels
+  for (i = x0; i <= x1; i++) queue_point(f, w, i, y0, &n);
+  for (i = x0; i <= x1; i++) queue_point(f, w, i, y1, &n);
+  for (j = y0 + 1; j < y1; j++) queue_point(f, w, x0, j, &n);
+  for (j = y0 + 1; j < y1; j++) queue_point(f, w, x1, j, &n);
+  flush_points(f, w, n);
+
+  // Check whether the border is uniform
+  int value = iters[(long) y0*width + x0];
+  int uniform = 1;
+  for (i = x0; i <= x1 && uniform; i++) {
+    uniform = iters[(long) y0*width + i] == value && iters[(long) y1*width + i] == value;
+  }
+  for (j = y0 + 1; j < y1 && uniform; j++) {
+    uniform = iters[(long) j*width + x0] == value && iters[(long) j*width + x1] == value;
+  }
+
+  if (uniform) {
+    for (j = y0 + 1; j < y1; j++) {
+      for (i = x0 + 1; i < x1; i++) {
+        iters[(long) j*width + i] = value;
+      }
+    }
+  } else if (x1 - x0 < MIN_SUBDIVIDE || y1 - y0 < MIN_SUBDIVIDE) {
+    n = 0;
+    for (j = y0 + 1; j < y1; j++) {
+      for (i = x0 + 1; i < x1; i++) {
+        queue_point(f, w, i, j, &n);
+      }
+    }
+    flush_points(f, w, n);
+  } else {
+    int xm = (x0 + x1) / 2;
+    int ym = (y0 + y1) / 2;
+    subdivide(f, w, x0, y0, xm, ym);
+    subdivide(f, w, xm, y0, x1, ym);
+    subdivide(f, w, x0, ym, xm, y1);
+    subdivide(f, w, xm, ym, x1, y1);
+  }
+}
+
+// Render a tile by recursive subdivision, then convert its iterations to colors
+static void subdivide_tile(struct frame *f, struct worker *w, struct tile *t) {
+  int width = bitmap_width(f->bm);
+  int i, j;
+
+  for (j = t->y0; j < t->y1; j++) {
+    for (i = t->x0; i < t->x1; i++) {
+      f->iters[(long) j*width + i] = -1;
+    }
+  }
+
+  subdivide(f, w, t->x0, t->y0, t->x1 - 1, t->y1 - 1);
+
+  for (j = t->y0; j < t->y1; j++) {
+    int *row = bitmap_row(f->bm, j);
+    for (i = t->x0; i < t->x1; i++) {
+      row[i] = iteration_to_color(f->iters[(long) j*width + i], f->max);
+    }
+  }
+}
+
+// Largest difference between the channels of two colors
+static int color_diff(int a, int b) {
+  int d = abs(GET_RED(a) - GET_RED(b));
+  int g = abs(GET_GREEN(a) - GET_GREEN(b));
+  int l = abs(GET_BLUE(a) - GET_BLUE(b));
+  if (g > d) d = g;
+  return l > d ? l : d;
+}
+
+// Whether pixel (x, y) differs from any of its eight neighbours by more than
+// the threshold, judged by the colors of the first pass
+static int is_edge(struct frame *f, int x, int y) {
+  int width = bitmap_width(f->bm);
+  int height = bitmap_height(f->bm);
+  int c = iteration_to_color(f->iters[(long) y*width + x], f->max);
+  int i, j;
+
+  if (f->threshold < 0) return 1;
+  for (j = y - 1; j <= y + 1; j++) {
+    if (j < 0 || j >= height) continue;
+    for (i = x - 1; i <= x + 1; i++) {
+      if (i < 0 || i >= width) continue;
+      if (color_diff(c, iteration_to_color(f->iters[(long) j*width + i], f->max)) > f->threshold) return 1;
+    }
+  }
+  return 0;
+}
+
+// Pseudo-random offset in [0, 1) for sample k of pixel (x, y). It depends only
+// on its arguments, so images are the same for any number of threads.
+static double jitter(int x, int y, int k) {
+  uint32_t h = (uint32_t) x*0x9e3779b1u ^ (uint32_t) y*0x85ebca77u ^ (uint32_t) k*0xc2b2ae3du;
+  h ^= h >> 16;
+  h *= 0x7feb352du;
+  h ^= h >> 15;
+  h *= 0x846ca68bu;
+  h ^= h >> 16;
+  return (h >> 8) * (1.0/16777216);
+}
+
+// Second pass: replace each edge pixel of a tile by the average of a grid of
+// samples spread over its area, each jittered within its cell. The first
+// pass's iterations no longer change, so neighbours in other tiles are safe
+// to read while their own edges are being resampled.
+static void antialias_tile(struct frame *f, struct worker *w, struct tile *t) {
+  int width = bitmap_width(f->bm);
+  int height = bitmap_height(f->bm);
+  double dx = (f->xmax - f->xmin)/width;
+  double dy = (f->ymax - f->ymin)/height;
+  int g = f->grid;
+  int samples = g*g;
+  int i, j, k;
+
+  for (j = t->y0; j < t->y1; j++) {
+    // Queue the samples of every edge pixel in the row
+    int n = 0, edges = 0;
+    for (i = t->x0; i < t->x1; i++) {
+      if (!is_edge(f, i, j)) continue;
+      w->idx[edges++] = i;
+      for (k = 0; k < samples; k++) {
+        w->cx[n] = f->xmin + (i + ((k % g) + jitter(i, j, 2*k))/g - 0.5)*dx;
+        w->cy[n] = f->ymin + (j + ((k / g) + jitter(i, j, 2*k + 1))/g - 0.5)*dy;
+        n++;
+      }
+    }
+    if (!edges) continue;
+    compute_points(f, w, n);
+
+    // Average the colors of each pixel's samples
+    int *row = bitmap_row(f->bm, j);
+    for (i = 0; i < edges; i++) {
+      int red = 0, green = 0, blue = 0;
+      for (k = 0; k < samples; k++) {
+        int c = iteration_to_color(w->out[i*samples + k], f->max);
+        red += GET_RED(c);
+        green += GET_GREEN(c);
+        blue += GET_BLUE(c);
+      }
+      row[w->idx[i]] = MAKE_RGBA((red + samples/2)/samples, (green + samples/2)/samples, (blue + samples/2)/samples, 0);
+    }
+    atomic_fetch_add_explicit(&f->resampled, edges, memory_order_relaxed);
+  }
+}
+
+// Whether the pass just finished is the frame's last
+static int last_pass(struct frame *f) {
+  return f->pass == PASS_ANTIALIAS || (f->stride == 1 && f->grid == 1);
+}
+
+// Worker thread: claim tiles from the oldest unfinished frame until shut down
+static void *render_worker(void *args) {
+  struct worker *w = (struct worker *) args;
+  struct renderer *r = w->r;
+  struct tile t;
+
+  pthread_mutex_lock(&r->lock);
+  for (;;) {
+    while (!r->head && !r->shutdown) {
+      pthread_cond_wait(&r->work, &r->lock);
+    }
+    if (!r->head) break;
+
+    // Claim a tile, and retire the frame from the queue once its last tile is
+    // claimed so that no worker touches it after it may have been deleted
+    struct frame *f = r->head;
+    if (!tile_queue_next(&f->tiles, &t)) {
+      r->head = f->next;
+      if (!r->head) r->tail = NULL;
+      continue;
+    }
+    if (tile_queue_empty(&f->tiles)) {
+      r->head = f->next;
+      if (!r->head) r->tail = NULL;
+    }
+    int pass = f->pass;
+    pthread_mutex_unlock(&r->lock);
+
+    worker_reserve(w, f->tiles.size, f->grid);
+    double start = now();
+    if (pass == PASS_ANTIALIAS) {
+      antialias_tile(f, w, &t);
+    } else if (f->key.bm) {
+      resample_tile(f, w, &t);
+    } else if (f->mode == RENDER_SUBDIVIDE) {
+      subdivide_tile(f, w, &t);
+    } else {
+      compute_tile(f, w, &t);
+    }
+    double elapsed = now() - start;
+    r->stats[w->id].busy += elapsed;
+    r->stats[w->id].tiles++;
+    f->tile_time[(t.y0/f->tiles.size)*f->tiles.cols + t.x0/f->tiles.size] += elapsed;
+
+    pthread_mutex_lock(&r->lock);
+    if (--f->pending == 0 && !last_pass(f)) {
+      // Let the owner look at the image of this pass before the next one
+      // starts changing it
+      if (f->progress) {
+        pthread_mutex_unlock(&r->lock);
+        f->progress(f, f->arg);
+        pthread_mutex_lock(&r->lock);
+      }
+
+      // Hand the tiles out again, ahead of later frames. Edges are only found
+      // once every pixel has its first sample, so they cross tiles correctly.
+      if (f->stride > 1) {
+        f->stride /= 2;
+      } else {
+        f->pass = PASS_ANTIALIAS;
+      }
+      tile_queue_init(&f->tiles, bitmap_width(f->bm), bitmap_height(f->bm), f->tiles.size);
+      tile_queue_set_order(&f->tiles, f->order);
+      f->pending = f->tiles.count;
+      f->next = r->head;
+      r->head = f;
+      if (!r->tail) r->tail = f;
+      pthread_cond_broadcast(&r->work);
+    } else if (f->pending == 0) {
+      // Let the owner post-process the finished image on this thread, in
+      // parallel with other frames, before render_wait() returns it
+      if (f->finish) {
+        pthread_mutex_unlock(&r->lock);
+        f->finish(f, f->arg);
+        pthread_mutex_lock(&r->lock);
+      }
+      f->done = 1;
+      pthread_cond_broadcast(&r->finished);
+    }
+  }
+  pthread_mutex_unlock(&r->lock);
+
+  free(w->cx);
+  free(w->cy);
+  free(w->out);
+  free(w->idx);
+  free(w);
+  return NULL;
+}
+
+// Paint each tile of a finished frame by the time spent on it, from black for
+// the cheapest through red and yellow to white for the most expensive, into a
+// bitmap the size of the frame
+void frame_heatmap(struct frame *f, struct bitmap *heat) {
+  struct tile_queue *q = &f->tiles;
+  double top = 0;
+  int i, x, y;
+  for (i = 0; i < q->count; i++) {
+    if (f->tile_time[i] > top) top = f->tile_time[i];
+  }
+
+  for (y = 0; y < q->height; y++) {
+    int *row = bitmap_row(heat, y);
+    for (x = 0; x < q->width; x++) {
+      double t = top > 0 ? f->tile_time[(y/q->size)*q->cols + x/q->size]/top : 0;
+      double red = 3*t, green = 3*t - 1, blue = 3*t - 2;
+      row[x] = MAKE_RGBA((int) (255*(red > 1 ? 1 : red)), (int) (255*(green < 0 ? 0 : green > 1 ? 1 : green)),
+                         (int) (255*(blue < 0 ? 0 : blue)), 0);
+    }
+  }
+}
+
+// Convert a iteration number to an RGBA color.
+// Here, we just scale to gray with a maximum of imax.
+// Modify this function to make more interesting colors.
+int iteration_to_color(int i, int max) {
+  int gray = 255 * i/max;
+  return MAKE_RGBA(gray, gray, gray, 0);
+}
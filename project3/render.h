@@ -0,0 +1,130 @@
+// render.h
+// Ann Keenan (akeenan2)
+
+#ifndef RENDER_H
+#define RENDER_H
+
+#include "bitmap.h"
+#include "kernel.h"
+#include "perturb.h"
+#include "tiles.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+
+// Render modes: every pixel, or Mariani-Silver rectangle subdivision
+enum {
+  RENDER_FULL = 0,
+  RENDER_SUBDIVIDE
+};
+
+// Passes over a frame's tiles: computing pixels, then resampling edges
+enum {
+  PASS_RENDER = 0,
+  PASS_ANTIALIAS
+};
+
+// Spacing of the samples in the first pass of a progressive render, so that
+// it computes 1/16 of the pixels and the next one 1/4
+#define PROGRESSIVE_STRIDE 4
+
+// Color levels by which a pixel must differ from a neighbour to be antialiased
+#define DEFAULT_AA_THRESHOLD 8
+
+struct frame;
+
+// A finished image with the same center as a frame, scale on either side of it,
+// from which the frame can be resampled instead of rendered
+struct keyframe {
+  struct bitmap *bm;
+  double scale;
+};
+
+// What to render into a frame's bitmap. Fill it in with designated initializers;
+// every field left out is zero, which turns its feature off.
+struct render_params {
+  const char *x;    // center as decimal strings, parsed exactly for deep zooms
+  const char *y;
+  double scale;
+  int max;
+  int kernel;
+  int mode;
+  int tile_size;
+  int precision;    // PRECISION_AUTO picks the cheapest one that resolves the pixels
+  void (*finish)(struct frame *f, void *arg);  // called by the worker that completes the frame
+  void *arg;
+  int samples;      // antialiasing samples per edge pixel, rounded down to a square; 0 or 1 for none
+  int threshold;    // color difference from a neighbour that makes a pixel an edge, negative for all
+  int progressive;  // render 1/16 and then 1/4 of the pixels before the rest; full mode only
+  void (*progress)(struct frame *f, void *arg);  // called with the image after each pass but the last
+  const struct fractal *fractal;  // Julia or Multibrot set, or NULL for the Mandelbrot set
+  const struct keyframe *key;     // resample this, computing only where it is unreliable; full mode only
+};
+
+// One image being rendered by the pool. Its tiles are claimed by whichever
+// workers are free, alongside the tiles of any other frame in flight.
+struct frame {
+  struct bitmap *bm;
+  int max;
+  double xmin;
+  double xmax;
+  double ymin;
+  double ymax;
+  int precision;
+  kernel_fn kernel;     // float and double precision
+  dd_kernel_fn dd_kernel;
+  family_fn family;     // Julia and Multibrot sets, in float or double precision
+  double k[2];          // Julia constant for family
+  double center[4];     // image center as double-doubles {xhi, xlo, yhi, ylo}, for dd_kernel
+  struct orbit *orbit;  // reference orbit for perturbation
+  // For double-double and perturbation, x and y are offsets from the center
+  int mode;
+  int *iters;           // image of iteration counts for subdivision, -1 where not yet computed
+  struct tile_queue tiles;
+  struct keyframe key;  // bm is NULL unless resampling
+  double *tile_time;    // seconds spent on each tile, over all passes
+  int *order;           // tile numbers, most expensive first by a probe of their centers
+  int pending;          // tiles not yet finished, guarded by the renderer lock
+  atomic_long computed; // number of points handed to the kernel
+  int grid;             // antialiasing samples per side of an edge pixel, 1 for none
+  int threshold;
+  int pass;             // PASS_RENDER or PASS_ANTIALIAS
+  int stride;           // spacing of the pixels computed in this render pass
+  int coarsest;         // stride of the first pass, whose samples later passes reuse
+  void (*progress)(struct frame *f, void *arg);
+  atomic_long resampled;// number of edge pixels antialiased
+  void (*finish)(struct frame *f, void *arg);
+  void *arg;
+  int done;
+  struct frame *next;   // next frame with tiles left to claim
+};
+
+// Work done by one worker thread since the renderer was created
+struct worker_stats {
+  double busy;          // seconds spent rendering tiles
+  long tiles;
+  long iterations;      // sum of the iteration counts of the points it computed
+};
+
+// A persistent pool of worker threads shared by every frame submitted to it
+struct renderer {
+  pthread_mutex_t lock;
+  pthread_cond_t work;
+  pthread_cond_t finished;
+  struct frame *head;   // frames with tiles left to claim, oldest first
+  struct frame *tail;
+  int shutdown;
+  int num_threads;
+  pthread_t *threads;
+  struct worker_stats *stats;  // one per thread, stable while no frame is in flight
+};
+
+struct renderer *render_create(int num_threads);
+void             render_delete(struct renderer *r);
+struct frame    *render_submit(struct renderer *r, struct bitmap *bm, const struct render_params *p);
+void             render_wait(struct renderer *r, struct frame *f);
+void             frame_delete(struct frame *f);
+void             frame_heatmap(struct frame *f, struct bitmap *heat);
+int              iteration_to_color(int i, int max);
+
+#endif
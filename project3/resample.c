@@ -0,0 +1,71 @@
+// resample.c
+// Ann Keenan (akeenan2)
+//
+// Bilinear resampling of a rendered image, used to derive movie frames from a
+// larger keyframe instead of iterating every pixel again.
+
+#include "resample.h"
+
+#include <math.h>
+
+// Largest difference between the channels of four colors
+static inline int spread4(int a, int b, int c, int d, int shift) {
+  int p = (a >> shift) & 0xff, q = (b >> shift) & 0xff, r = (c >> shift) & 0xff, s = (d >> shift) & 0xff;
+  int hi = p > q ? p : q, lo = p < q ? p : q;
+  hi = hi > r ? hi : r;
+  lo = lo < r ? lo : r;
+  hi = hi > s ? hi : s;
+  lo = lo < s ? lo : s;
+  return hi - lo;
+}
+
+// Blend one channel of four colors with 8-bit weights wu across and wv down
+static inline int blend(int a, int b, int c, int d, int wu, int wv, int shift) {
+  int top = ((a >> shift) & 0xff)*(256 - wu) + ((b >> shift) & 0xff)*wu;
+  int bottom = ((c >> shift) & 0xff)*(256 - wu) + ((d >> shift) & 0xff)*wu;
+  return (top*(256 - wv) + bottom*wv + 32768) >> 16;
+}
+
+// Sample src at the n points (u0 + i*du, v), in pixel coordinates, into out.
+// spread[i] is the largest channel difference between the four pixels that
+// went into out[i], an estimate of how far the result may be from the truth.
+// Every point is independent, so the compiler vectorizes the loop, and
+// target_clones adds an AVX2 copy picked at load time.
+__attribute__((target_clones("avx2", "default")))
+void resample_row(struct bitmap *src, double u0, double du, double v, int n, int *restrict out, int *restrict spread) {
+  int width = bitmap_width(src);
+  int height = bitmap_height(src);
+  int i;
+
+  // The row pair and vertical weight are shared by the whole row
+  if (v < 0) v = 0;
+  if (v > height - 1) v = height - 1;
+  int y = (int) v;
+  if (y > height - 2) y = height - 2;
+  if (y < 0) y = 0;
+  int wv = (int) ((v - y)*256);
+  const int *restrict r0 = bitmap_row(src, y);
+  const int *restrict r1 = bitmap_row(src, height > 1 ? y + 1 : y);
+
+  // Points must lie within the image, as they do for a keyframe that covers the
+  // frame; the clamps only guard against rounding at the last column, where u
+  // is taken as the right edge of the last column pair, as v is for the rows
+  int xmax = width > 1 ? width - 2 : 0;
+  int step = width > 1;
+
+  for (i = 0; i < n; i++) {
+    double u = u0 + i*du;
+    u = u < 0 ? 0 : u;
+    u = u > width - 1 ? width - 1 : u;
+    int x = (int) u;
+    x = x > xmax ? xmax : x;
+    int wu = (int) ((u - x)*256);
+    int x1 = x + step;
+    int a = r0[x], b = r0[x1], c = r1[x], d = r1[x1];
+
+    out[i] = MAKE_RGBA(blend(a, b, c, d, wu, wv, 16), blend(a, b, c, d, wu, wv, 8), blend(a, b, c, d, wu, wv, 0), 0);
+    int sr = spread4(a, b, c, d, 16), sg = spread4(a, b, c, d, 8), sb = spread4(a, b, c, d, 0);
+    int s = sr > sg ? sr : sg;
+    spread[i] = s > sb ? s : sb;
+  }
+}
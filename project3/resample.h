@@ -0,0 +1,11 @@
+// resample.h
+// Ann Keenan (akeenan2)
+
+#ifndef RESAMPLE_H
+#define RESAMPLE_H
+
+#include "bitmap.h"
+
+void resample_row(struct bitmap *src, double u0, double du, double v, int n, int *restrict out, int *restrict spread);
+
+#endif
@@ -0,0 +1,137 @@
+// tilecache.c
+// Ann Keenan (akeenan2)
+//
+// Two-level tile cache for the render server. A tile's address is the FNV-1a
+// hash of its request key, so the same view maps to the same file whichever
+// client asks for it. Memory holds up to capacity tiles and evicts the least
+// recently used; the directory keeps all of them.
+
+#include "tilecache.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#define MAXBUF 512
+
+static uint64_t hash_key(const char *key) {
+  uint64_t h = 14695981039346656037ULL;
+  for (; *key; key++) {
+    h = (h ^ (unsigned char) *key) * 1099511628211ULL;
+  }
+  return h;
+}
+
+static void cache_path(struct tile_cache *c, uint64_t hash, char *path, int size) {
+  snprintf(path, size, "%s/%016llx.bmp", c->dir, (unsigned long long) hash);
+}
+
+// Create a cache keeping capacity tiles in memory and all of them in dir, which
+// is created if needed. Returns NULL, with errno set, on failure.
+struct tile_cache *tile_cache_create(const char *dir, int capacity) {
+  if (mkdir(dir, 0755) == -1 && errno != EEXIST) return NULL;
+
+  struct tile_cache *c = calloc(1, sizeof(*c));
+  if (!c) return NULL;
+  c->entries = calloc(capacity, sizeof(struct cache_entry));
+  if (!c->entries) {
+    free(c);
+    return NULL;
+  }
+  c->dir = dir;
+  c->capacity = capacity;
+  return c;
+}
+
+void tile_cache_delete(struct tile_cache *c) {
+  int i;
+  for (i = 0; i < c->count; i++) {
+    free(c->entries[i].key);
+    free(c->entries[i].data);
+  }
+  free(c->entries);
+  free(c);
+}
+
+// Take a free slot, or the least recently used one once memory is full
+static struct cache_entry *cache_slot(struct tile_cache *c) {
+  if (c->count < c->capacity) return &c->entries[c->count++];
+
+  struct cache_entry *e = &c->entries[0];
+  int i;
+  for (i = 1; i < c->count; i++) {
+    if (c->entries[i].used < e->used) e = &c->entries[i];
+  }
+  free(e->key);
+  free(e->data);
+  memset(e, 0, sizeof(*e));
+  return e;
+}
+
+// Read the tile file at path into a memory slot
+static struct cache_entry *cache_load(struct tile_cache *c, const char *key, uint64_t hash, const char *path) {
+  FILE *file = fopen(path, "rb");
+  if (!file) return NULL;
+
+  struct stat st;
+  unsigned char *data = NULL;
+  char *copy = strdup(key);
+  if (fstat(fileno(file), &st) == -1 || !copy || !(data = malloc(st.st_size)) ||
+      fread(data, 1, st.st_size, file) != (size_t) st.st_size) {
+    fclose(file);
+    free(copy);
+    free(data);
+    return NULL;
+  }
+  fclose(file);
+
+  struct cache_entry *e = cache_slot(c);
+  e->hash = hash;
+  e->key = copy;
+  e->data = data;
+  e->size = st.st_size;
+  e->used = ++c->clock;
+  return e;
+}
+
+// Look up a tile, first in memory and then on disk. Returns NULL on a miss.
+// The entry stays valid until the next call that may evict it.
+struct cache_entry *tile_cache_get(struct tile_cache *c, const char *key) {
+  uint64_t hash = hash_key(key);
+  int i;
+  for (i = 0; i < c->count; i++) {
+    struct cache_entry *e = &c->entries[i];
+    if (e->hash == hash && strcmp(e->key, key) == 0) {
+      e->used = ++c->clock;
+      c->hits++;
+      return e;
+    }
+  }
+
+  char path[MAXBUF];
+  cache_path(c, hash, path, sizeof(path));
+  struct cache_entry *e = cache_load(c, key, hash, path);
+  if (e) {
+    c->disk_hits++;
+  } else {
+    c->misses++;
+  }
+  return e;
+}
+
+// Store a freshly rendered tile. It is written to a temporary file and renamed
+// into place, so a crash never leaves a partial tile under its address.
+struct cache_entry *tile_cache_put(struct tile_cache *c, const char *key, struct bitmap *bm) {
+  uint64_t hash = hash_key(key);
+  char path[MAXBUF], tmp[MAXBUF + 8];
+  cache_path(c, hash, path, sizeof(path));
+  snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+
+  if (!bitmap_save(bm, tmp) || rename(tmp, path) == -1) {
+    remove(tmp);
+    return NULL;
+  }
+  return cache_load(c, key, hash, path);
+}
@@ -0,0 +1,39 @@
+// tilecache.h
+// Ann Keenan (akeenan2)
+
+#ifndef TILECACHE_H
+#define TILECACHE_H
+
+#include "bitmap.h"
+
+#include <stdint.h>
+
+// A rendered tile, stored as the bytes of its BMP file
+struct cache_entry {
+  uint64_t hash;
+  char *key;
+  unsigned char *data;
+  long size;
+  long used;            // time of last use, for eviction
+};
+
+// Tiles addressed by a hash of the parameters that determine their pixels. The
+// most recently used ones are kept in memory, and every tile is also written
+// to dir/<hash>.bmp so that it survives a restart of the server.
+struct tile_cache {
+  const char *dir;
+  int capacity;
+  int count;
+  long clock;
+  struct cache_entry *entries;
+  long hits;
+  long disk_hits;
+  long misses;
+};
+
+struct tile_cache  *tile_cache_create(const char *dir, int capacity);
+void                tile_cache_delete(struct tile_cache *c);
+struct cache_entry *tile_cache_get(struct tile_cache *c, const char *key);
+struct cache_entry *tile_cache_put(struct tile_cache *c, const char *key, struct bitmap *bm);
+
+#endif
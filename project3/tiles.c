@@ -0,0 +1,42 @@
+// tiles.c
+// Ann Keenan (akeenan2)
+
+#include "tiles.h"
+
+#include <stddef.h>
+
+// Prepare a queue of size x size tiles covering a width x height image
+void tile_queue_init(struct tile_queue *q, int width, int height, int size) {
+  if (size < 1) size = DEFAULT_TILE_SIZE;
+  q->width = width;
+  q->height = height;
+  q->size = size;
+  q->cols = (width + size - 1) / size;
+  q->count = q->cols * ((height + size - 1) / size);
+  q->order = NULL;
+  atomic_init(&q->next, 0);
+}
+
+// Hand the tiles out in the given order of their numbers, row by row from the
+// top left, instead of in that order. The array must outlive the queue.
+void tile_queue_set_order(struct tile_queue *q, const int *order) {
+  q->order = order;
+}
+
+// Claim the next unprocessed tile. Returns 0 once every tile has been handed out.
+int tile_queue_next(struct tile_queue *q, struct tile *t) {
+  int n = atomic_fetch_add_explicit(&q->next, 1, memory_order_relaxed);
+  if (n >= q->count) return 0;
+  if (q->order) n = q->order[n];
+
+  t->x0 = (n % q->cols) * q->size;
+  t->y0 = (n / q->cols) * q->size;
+  t->x1 = t->x0 + q->size < q->width ? t->x0 + q->size : q->width;
+  t->y1 = t->y0 + q->size < q->height ? t->y0 + q->size : q->height;
+  return 1;
+}
+
+// Check whether every tile has been handed out
+int tile_queue_empty(struct tile_queue *q) {
+  return atomic_load_explicit(&q->next, memory_order_relaxed) >= q->count;
+}
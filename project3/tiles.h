@@ -0,0 +1,36 @@
+// tiles.h
+// Ann Keenan (akeenan2)
+
+#ifndef TILES_H
+#define TILES_H
+
+#include <stdatomic.h>
+
+#define DEFAULT_TILE_SIZE 32
+
+// A rectangle of pixels [x0, x1) x [y0, y1) handed out to one thread at a time
+struct tile {
+  int x0;
+  int y0;
+  int x1;
+  int y1;
+};
+
+// Splits an image into square tiles which threads claim dynamically, so a thread
+// that finishes cheap tiles early simply takes more of them.
+struct tile_queue {
+  int width;
+  int height;
+  int size;
+  int cols;
+  int count;
+  const int *order;     // tile numbers in the order to hand them out, or NULL for row by row
+  atomic_int next;
+};
+
+void tile_queue_init(struct tile_queue *q, int width, int height, int size);
+void tile_queue_set_order(struct tile_queue *q, const int *order);
+int  tile_queue_next(struct tile_queue *q, struct tile *t);
+int  tile_queue_empty(struct tile_queue *q);
+
+#endif
@@ -0,0 +1,159 @@
+// video.c
+// Ann Keenan (akeenan2)
+//
+// Movie output. Frames are converted by video_encode(), which is safe to call
+// from any thread as soon as a frame is rendered, and written strictly in order
+// by video_write(). Streams are written top row first, so they show the same
+// picture as the bottom-up BMP files.
+
+#include "video.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define MAXBUF 256
+
+int video_parse(const char *name) {
+  if (strcmp(name, "bmp") == 0) return VIDEO_BMP;
+  if (strcmp(name, "y4m") == 0) return VIDEO_Y4M;
+  if (strcmp(name, "rgb") == 0) return VIDEO_RGB;
+  return -1;
+}
+
+// Open the output. Returns NULL, with errno set, if the stream can't be opened.
+struct video *video_open(int format, const char *dest, int width, int height, int fps) {
+  struct video *v = calloc(1, sizeof(*v));
+  if (!v) return NULL;
+  v->format = format;
+  v->width = width;
+  v->height = height;
+  v->fps = fps;
+  v->dest = dest;
+
+  if (format != VIDEO_BMP) {
+    v->out = strcmp(dest, "-") == 0 ? stdout : fopen(dest, "wb");
+    if (!v->out) {
+      free(v);
+      return NULL;
+    }
+  }
+  if (format == VIDEO_Y4M) {
+    // Full range BT.601 chroma subsampled 2x2, as produced by video_encode()
+    fprintf(v->out, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C420jpeg XCOLORRANGE=FULL\n", width, height, fps);
+  }
+  return v;
+}
+
+// Number of bytes video_encode() produces for one frame
+long video_frame_size(struct video *v) {
+  long pixels = (long) v->width*v->height;
+  long chroma = (long) ((v->width + 1)/2)*((v->height + 1)/2);
+  switch (v->format) {
+    case VIDEO_Y4M:
+      return pixels + 2*chroma;
+    case VIDEO_RGB:
+      return 3*pixels;
+  }
+  return 0;
+}
+
+// Convert one row of RGBA pixels to luma, Y = 0.299 R + 0.587 G + 0.114 B.
+// Written as a plain loop over independent pixels so that the compiler
+// vectorizes it; target_clones adds an AVX2 copy picked at load time.
+__attribute__((target_clones("avx2", "default")))
+static void rgba_to_luma(const int *rgba, unsigned char *y, int n) {
+  int i;
+  for (i = 0; i < n; i++) {
+    unsigned int p = rgba[i];
+    unsigned int r = (p >> 16) & 0xff, g = (p >> 8) & 0xff, b = p & 0xff;
+    y[i] = (77*r + 150*g + 29*b + 128) >> 8;
+  }
+}
+
+// Convert a pair of RGBA rows to one row of chroma, averaging each 2x2 block.
+// Pure blue and red round up to 256, so the results are clamped.
+// The width must be even; the odd last column is handled by the caller.
+__attribute__((target_clones("avx2", "default")))
+static void rgba_to_chroma(const int *row0, const int *row1, unsigned char *u, unsigned char *v, int n) {
+  int i;
+  for (i = 0; i < n; i++) {
+    unsigned int a = row0[2*i], b = row0[2*i + 1], c = row1[2*i], d = row1[2*i + 1];
+    int r = (((a >> 16) & 0xff) + ((b >> 16) & 0xff) + ((c >> 16) & 0xff) + ((d >> 16) & 0xff) + 2) >> 2;
+    int g = (((a >> 8) & 0xff) + ((b >> 8) & 0xff) + ((c >> 8) & 0xff) + ((d >> 8) & 0xff) + 2) >> 2;
+    int bl = ((a & 0xff) + (b & 0xff) + (c & 0xff) + (d & 0xff) + 2) >> 2;
+    int cb = (-43*r - 85*g + 128*bl + 32768 + 128) >> 8;
+    int cr = (128*r - 107*g - 21*bl + 32768 + 128) >> 8;
+    u[i] = cb < 255 ? cb : 255;
+    v[i] = cr < 255 ? cr : 255;
+  }
+}
+
+// Chroma of a single odd column, averaging the one or two pixels in it
+static void chroma_edge(int a, int c, unsigned char *u, unsigned char *v) {
+  int r = (GET_RED(a) + GET_RED(c) + 1) >> 1;
+  int g = (GET_GREEN(a) + GET_GREEN(c) + 1) >> 1;
+  int b = (GET_BLUE(a) + GET_BLUE(c) + 1) >> 1;
+  int cb = (-43*r - 85*g + 128*b + 32768 + 128) >> 8;
+  int cr = (128*r - 107*g - 21*b + 32768 + 128) >> 8;
+  *u = cb < 255 ? cb : 255;
+  *v = cr < 255 ? cr : 255;
+}
+
+// Convert a rendered frame into buf, which holds video_frame_size() bytes
+void video_encode(struct video *v, struct bitmap *bm, unsigned char *buf) {
+  int w = v->width, h = v->height;
+  int i, j;
+
+  if (v->format == VIDEO_RGB) {
+    for (j = 0; j < h; j++) {
+      const int *row = bitmap_row(bm, h - 1 - j);
+      unsigned char *s = buf + (long) j*w*3;
+      for (i = 0; i < w; i++) {
+        *s++ = GET_RED(row[i]);
+        *s++ = GET_GREEN(row[i]);
+        *s++ = GET_BLUE(row[i]);
+      }
+    }
+  } else if (v->format == VIDEO_Y4M) {
+    int cw = (w + 1)/2, ch = (h + 1)/2;
+    unsigned char *y = buf;
+    unsigned char *u = buf + (long) w*h;
+    unsigned char *vv = u + (long) cw*ch;
+
+    for (j = 0; j < h; j++) {
+      rgba_to_luma(bitmap_row(bm, h - 1 - j), y + (long) j*w, w);
+    }
+    for (j = 0; j < ch; j++) {
+      // Top-down rows 2j and 2j+1, repeating the last row for an odd height
+      const int *row0 = bitmap_row(bm, h - 1 - 2*j);
+      const int *row1 = 2*j + 1 < h ? bitmap_row(bm, h - 2 - 2*j) : row0;
+      rgba_to_chroma(row0, row1, u + (long) j*cw, vv + (long) j*cw, w/2);
+      if (w % 2) {
+        chroma_edge(row0[w - 1], row1[w - 1], u + (long) j*cw + cw - 1, vv + (long) j*cw + cw - 1);
+      }
+    }
+  }
+}
+
+// Write the next frame: bm itself for BMP output, otherwise its encoding in buf
+int video_write(struct video *v, struct bitmap *bm, const unsigned char *buf) {
+  v->frames++;
+  if (v->format == VIDEO_BMP) {
+    char filename[MAXBUF];
+    snprintf(filename, sizeof(filename), "%s%d.bmp", v->dest, v->frames);
+    return bitmap_save(bm, filename);
+  }
+  if (v->format == VIDEO_Y4M && fputs("FRAME\n", v->out) == EOF) return 0;
+  long size = video_frame_size(v);
+  return fwrite(buf, 1, size, v->out) == (size_t) size;
+}
+
+int video_close(struct video *v) {
+  int ok = 1;
+  if (v->out) {
+    ok = fflush(v->out) == 0;
+    if (v->out != stdout) ok = fclose(v->out) == 0 && ok;
+  }
+  free(v);
+  return ok;
+}
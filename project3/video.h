@@ -0,0 +1,36 @@
+// video.h
+// Ann Keenan (akeenan2)
+
+#ifndef VIDEO_H
+#define VIDEO_H
+
+#include "bitmap.h"
+
+#include <stdio.h>
+
+// Output formats for a movie: numbered BMP files, or a single YUV4MPEG2 or raw
+// RGB24 stream that an encoder such as ffmpeg can read from a pipe.
+enum {
+  VIDEO_BMP = 0,
+  VIDEO_Y4M,
+  VIDEO_RGB
+};
+
+struct video {
+  int format;
+  int width;
+  int height;
+  int fps;
+  const char *dest;   // file prefix for BMP, path or "-" for stdout otherwise
+  FILE *out;
+  int frames;         // number of frames written so far
+};
+
+int           video_parse(const char *name);
+struct video *video_open(int format, const char *dest, int width, int height, int fps);
+long          video_frame_size(struct video *v);
+void          video_encode(struct video *v, struct bitmap *bm, unsigned char *buf);
+int           video_write(struct video *v, struct bitmap *bm, const unsigned char *buf);
+int           video_close(struct video *v);
+
+#endif
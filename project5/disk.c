@@ -3,6 +3,8 @@ Do not modify this file.
 Make all of your changes to main.c instead.
 */
 
+#define _GNU_SOURCE
+
 #include "disk.h"
 
 #include <unistd.h>
@@ -11,6 +13,9 @@ Make all of your changes to main.c instead.
 #include <string.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sys/uio.h>
 
 extern ssize_t pread (int __fd, void *__buf, size_t __nbytes, __off_t __offset);
 extern ssize_t pwrite (int __fd, const void *__buf, size_t __nbytes, __off_t __offset);
@@ -20,6 +25,18 @@ struct disk {
 	int fd;
 	int block_size;
 	int nblocks;
+
+	/* the asynchronous queue, and its thread once started. */
+	pthread_mutex_t lock;
+	pthread_cond_t wake;
+	pthread_cond_t done;
+	struct disk_request *head;
+	struct disk_request *tail;
+	int started;
+	int stopping;
+	pthread_t thread;
+
+	struct disk_stats stats;
 };
 
 struct disk * disk_open( const char *diskname, int nblocks )
@@ -38,6 +55,14 @@ struct disk * disk_open( const char *diskname, int nblocks )
 	d->block_size = BLOCK_SIZE;
 	d->nblocks = nblocks;
 
+	pthread_mutex_init(&d->lock,0);
+	pthread_cond_init(&d->wake,0);
+	pthread_cond_init(&d->done,0);
+	d->head = d->tail = 0;
+	d->started = 0;
+	d->stopping = 0;
+	memset(&d->stats,0,sizeof(d->stats));
+
 	if(ftruncate(d->fd,d->nblocks*d->block_size)<0) {
 		close(d->fd);
 		free(d);
@@ -47,6 +72,20 @@ struct disk * disk_open( const char *diskname, int nblocks )
 	return d;
 }
 
+/* Count a call that moved n blocks, from any thread. */
+static void disk_count( struct disk *d, int write, int n )
+{
+	pthread_mutex_lock(&d->lock);
+	if(write) {
+		d->stats.writes++;
+		d->stats.blocks_written += n;
+	} else {
+		d->stats.reads++;
+		d->stats.blocks_read += n;
+	}
+	pthread_mutex_unlock(&d->lock);
+}
+
 void disk_write( struct disk *d, int block, const char *data )
 {
 	if(block<0 || block>=d->nblocks) {
@@ -59,6 +98,7 @@ void disk_write( struct disk *d, int block, const char *data )
 		fprintf(stderr,"disk_write: failed to write block #%d: %s\n",block,strerror(errno));
 		abort();
 	}
+	disk_count(d,1,1);
 }
 
 void disk_read( struct disk *d, int block, char *data )
@@ -73,6 +113,150 @@ void disk_read( struct disk *d, int block, char *data )
 		fprintf(stderr,"disk_read: failed to read block #%d: %s\n",block,strerror(errno));
 		abort();
 	}
+	disk_count(d,0,1);
+}
+
+static void disk_check( struct disk *d, const char *name, int block, int n )
+{
+	if(block<0 || n<1 || block+n>d->nblocks) {
+		fprintf(stderr,"%s: invalid blocks #%d-%d\n",name,block,block+n-1);
+		abort();
+	}
+}
+
+void disk_read_range( struct disk *d, int block, char *data, int n )
+{
+	disk_check(d,"disk_read_range",block,n);
+
+	ssize_t actual = pread(d->fd,data,(size_t)n*d->block_size,(off_t)block*d->block_size);
+	if(actual!=(ssize_t)n*d->block_size) {
+		fprintf(stderr,"disk_read_range: failed to read blocks #%d-%d: %s\n",block,block+n-1,strerror(errno));
+		abort();
+	}
+	disk_count(d,0,n);
+}
+
+void disk_write_range( struct disk *d, int block, const char *data, int n )
+{
+	disk_check(d,"disk_write_range",block,n);
+
+	ssize_t actual = pwrite(d->fd,data,(size_t)n*d->block_size,(off_t)block*d->block_size);
+	if(actual!=(ssize_t)n*d->block_size) {
+		fprintf(stderr,"disk_write_range: failed to write blocks #%d-%d: %s\n",block,block+n-1,strerror(errno));
+		abort();
+	}
+	disk_count(d,1,n);
+}
+
+/* Move n blocks between the disk and the buffers, IOV_MAX at a time. */
+static void disk_vector( struct disk *d, const char *name, int write, int block, char **data, int n )
+{
+	struct iovec iov[IOV_MAX];
+	int i, done, count;
+
+	disk_check(d,name,block,n);
+
+	for(done=0;done<n;done+=count) {
+		count = n-done < IOV_MAX ? n-done : IOV_MAX;
+		for(i=0;i<count;i++) {
+			iov[i].iov_base = data[done+i];
+			iov[i].iov_len = d->block_size;
+		}
+
+		off_t offset = (off_t)(block+done)*d->block_size;
+		ssize_t actual = write ? pwritev(d->fd,iov,count,offset) : preadv(d->fd,iov,count,offset);
+		if(actual!=(ssize_t)count*d->block_size) {
+			fprintf(stderr,"%s: failed to %s blocks #%d-%d: %s\n",name,write ? "write" : "read",block+done,block+done+count-1,strerror(errno));
+			abort();
+		}
+		disk_count(d,write,count);
+	}
+}
+
+void disk_readv( struct disk *d, int block, char **data, int n )
+{
+	disk_vector(d,"disk_readv",0,block,data,n);
+}
+
+void disk_writev( struct disk *d, int block, char **data, int n )
+{
+	disk_vector(d,"disk_writev",1,block,data,n);
+}
+
+/* Do queued requests in order until the disk is closed. */
+static void * disk_thread( void *arg )
+{
+	struct disk *d = arg;
+	struct disk_request *r;
+
+	pthread_mutex_lock(&d->lock);
+	while(1) {
+		while(!d->head && !d->stopping) {
+			pthread_cond_wait(&d->wake,&d->lock);
+		}
+		if(!d->head) break;
+
+		r = d->head;
+		pthread_mutex_unlock(&d->lock);
+		disk_vector(d,"disk_submit",r->write,r->block,r->data,r->n);
+		pthread_mutex_lock(&d->lock);
+
+		d->head = r->next;
+		if(!d->head) d->tail = 0;
+		r->done = 1;
+		pthread_cond_broadcast(&d->done);
+	}
+	pthread_mutex_unlock(&d->lock);
+	return 0;
+}
+
+void disk_submit( struct disk *d, struct disk_request *r )
+{
+	disk_check(d,"disk_submit",r->block,r->n);
+
+	pthread_mutex_lock(&d->lock);
+	if(!d->started) {
+		if(pthread_create(&d->thread,0,disk_thread,d)!=0) {
+			fprintf(stderr,"disk_submit: couldn't start the disk thread: %s\n",strerror(errno));
+			abort();
+		}
+		d->started = 1;
+	}
+	r->done = 0;
+	r->next = 0;
+	if(d->tail) {
+		d->tail->next = r;
+	} else {
+		d->head = r;
+	}
+	d->tail = r;
+	d->stats.requests++;
+	pthread_cond_signal(&d->wake);
+	pthread_mutex_unlock(&d->lock);
+}
+
+int disk_poll( struct disk *d, struct disk_request *r )
+{
+	pthread_mutex_lock(&d->lock);
+	int done = r->done;
+	pthread_mutex_unlock(&d->lock);
+	return done;
+}
+
+void disk_wait( struct disk *d, struct disk_request *r )
+{
+	pthread_mutex_lock(&d->lock);
+	while(!r->done) {
+		pthread_cond_wait(&d->done,&d->lock);
+	}
+	pthread_mutex_unlock(&d->lock);
+}
+
+void disk_get_stats( struct disk *d, struct disk_stats *s )
+{
+	pthread_mutex_lock(&d->lock);
+	*s = d->stats;
+	pthread_mutex_unlock(&d->lock);
 }
 
 int disk_nblocks( struct disk *d )
@@ -82,6 +266,13 @@ int disk_nblocks( struct disk *d )
 
 void disk_close( struct disk *d )
 {
+	if(d->started) {
+		pthread_mutex_lock(&d->lock);
+		d->stopping = 1;
+		pthread_cond_signal(&d->wake);
+		pthread_mutex_unlock(&d->lock);
+		pthread_join(d->thread,0);
+	}
 	close(d->fd);
 	free(d);
 }
@@ -32,6 +32,61 @@ and "data" is a pointer to where the data will be placed.
 
 void disk_read( struct disk *d, int block, char *data );
 
+/*
+Read or write n consecutive blocks, starting at block, from or to one
+buffer of n*BLOCK_SIZE bytes, with a single call.
+*/
+
+void disk_read_range( struct disk *d, int block, char *data, int n );
+void disk_write_range( struct disk *d, int block, const char *data, int n );
+
+/*
+Read or write n consecutive blocks, starting at block, from or to the n
+buffers in data, each BLOCK_SIZE bytes, which need not be next to each
+other. This is a single call for up to IOV_MAX blocks.
+*/
+
+void disk_readv( struct disk *d, int block, char **data, int n );
+void disk_writev( struct disk *d, int block, char **data, int n );
+
+/*
+A request for the asynchronous queue: read or write n consecutive blocks,
+as disk_readv or disk_writev. The caller owns the request and its buffers
+until it is done.
+*/
+
+struct disk_request {
+	int write;
+	int block;
+	char **data;
+	int n;
+	int done;
+	struct disk_request *next;
+};
+
+/*
+Queue a request, to be done in order by a thread of the disk's own.
+disk_poll returns whether a request is done, and disk_wait waits for it.
+*/
+
+void disk_submit( struct disk *d, struct disk_request *r );
+int  disk_poll( struct disk *d, struct disk_request *r );
+void disk_wait( struct disk *d, struct disk_request *r );
+
+/*
+Counts of the calls made to the disk file and of the blocks they moved.
+*/
+
+struct disk_stats {
+	long reads;
+	long writes;
+	long blocks_read;
+	long blocks_written;
+	long requests;
+};
+
+void disk_get_stats( struct disk *d, struct disk_stats *s );
+
 /*
 Return the number of blocks in the virtual disk.
 */
@@ -39,7 +94,7 @@ Return the number of blocks in the virtual disk.
 int disk_nblocks( struct disk *d );
 
 /*
-Close the virtual disk.
+Close the virtual disk, once its queued requests are done.
 */
 
 void disk_close( struct disk *d );
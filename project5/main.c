@@ -9,16 +9,29 @@ how to use the page table and disk interfaces.
 #include "page_table.h"
 #include "disk.h"
 #include "program.h"
+#include "trace.h"
 
 #include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <unistd.h>
+
+// most dirty frames the cleaner writes between taking the lock
+#define CLEAN_BATCH 32
+
+// references buffered before each write to the trace
+#define TRACE_BUFFER 65536
 
 struct frameEntry {
 	int page;
 	int bits;
+	int referenced; // set by any access since the policy last cleared it
+	int prefetched; // first of a readahead window, not used yet
+	int writing;    // being written back by the cleaner
 };
 
 int npages;
@@ -29,18 +42,116 @@ struct disk *disk;
 
 int *frameArr;
 struct frameEntry *frameTable;
-int *pageUsage;
 int currFrame;
 
+// frames never used yet, taken in order from the top of the stack
+int *freeFrames;
+int nfree;
+
+// frames from the most recently faulted on (head) to the least (tail),
+// linked through their frame numbers
+int *lruPrev;
+int *lruNext;
+int lruHead;
+int lruTail;
+
+// next frame the clock algorithm looks at
+int clockHand;
+
+// A replacement policy picks the frame to evict, and hears about each page
+// read into a frame (used unless read ahead) and each later fault on one
+struct policy {
+	const char *name;
+	int (*victim)( struct page_table *pt );
+	void (*insert)( int frame, int used );
+	void (*access)( int frame );
+};
+
+int rand_victim( struct page_table *pt );
+void rand_insert( int frame, int used );
+void rand_access( int frame );
+int fifo_victim( struct page_table *pt );
+void fifo_insert( int frame, int used );
+void fifo_access( int frame );
+int lru_victim( struct page_table *pt );
+void lru_insert( int frame, int used );
+void lru_access( int frame );
+int clock_victim( struct page_table *pt );
+void clock_insert( int frame, int used );
+void clock_access( int frame );
+
+struct policy policies[] = {
+	{"rand", rand_victim, rand_insert, rand_access},
+	{"fifo", fifo_victim, fifo_insert, fifo_access},
+	{"clock", clock_victim, clock_insert, clock_access},
+	{"custom", lru_victim, lru_insert, lru_access}, // lru algorithm
+};
+
+#define NPOLICIES (int)(sizeof(policies)/sizeof(policies[0]))
+
+// Readahead. Two misses the same distance apart start a stream, and the next
+// raSize pages along it are read into frames. The window's first page is
+// mapped with no access, and its first touch reads the next window, twice as
+// big; if it is evicted before being touched, the window shrinks again.
+#define RA_MIN 4
+#define RA_MAX 64
+
+int readahead;
+int raLast;
+int raStride;
+int raSize;
+int raMarker;
+int raNext;
+int readaheadPages;
+int readaheadHits;
+int readaheadCalls;
+
+// Tracing. Every page has its own frame and only the page last used is
+// accessible, so each move to another page faults and is recorded.
+int traceFd;
+int traceCurrent;
+long traceCount;
+int traceUsed;
+uint32_t traceBuffer[TRACE_BUFFER];
+
 int diskReads;
 int diskWrites;
 int pageFaults;
-
-void rand_fault_handler( struct page_table *pt, int page );
-void fifo_fault_handler( struct page_table *pt, int page );
-void lru_fault_handler( struct page_table *pt, int page );
+int referenceFaults;
+
+// The replacement policy runs under frameLock, as the cleaner thread also
+// reads and changes the frame table
+struct policy *policy;
+pthread_mutex_t frameLock = PTHREAD_MUTEX_INITIALIZER;
+
+// Background write-back. When fewer than lowWater frames are clean, the
+// cleaner writes dirty frames out until highWater are, so that evicting a
+// frame seldom has to wait for a write.
+int cleaning;
+int lowWater;
+int highWater;
+int ndirty;
+int stopCleaner;
+int cleanerWrites;
+pthread_t cleaner;
+pthread_cond_t cleanerWake = PTHREAD_COND_INITIALIZER;
+pthread_cond_t writeDone = PTHREAD_COND_INITIALIZER;
+
+void page_fault_handler( struct page_table *pt, int page );
+void locked_fault_handler( struct page_table *pt, int page );
+int take_frame( struct page_table *pt );
 int find_empty( struct page_table *pt );
 void remove_page( struct page_table *pt, int frame );
+void lru_unlink( int frame );
+void lru_push( int frame );
+int reference_fault( struct page_table *pt, int page );
+void reference_clear( struct page_table *pt, int frame );
+void map_page( struct page_table *pt, int page, int frame, int bits );
+void *cleaner_thread( void *arg );
+void readahead_miss( struct page_table *pt, int page, int frame );
+void readahead_hit( struct page_table *pt, int page, int frame );
+void trace_fault_handler( struct page_table *pt, int page );
+int trace_flush();
 
 // helper function for debugging
 void print_table() {
@@ -56,8 +167,40 @@ int main( int argc, char *argv[] )
 	// initialize random seed
 	srand(time(NULL));
 
+	// -c starts the cleaner, -w sets its watermarks in frames, -r reads ahead,
+	// -t records the program's references instead of paging
+	int c, i;
+	const char *tracefile = NULL;
+	cleaning = 0;
+	readahead = 0;
+	lowWater = highWater = 0;
+	while((c = getopt(argc, argv, "cw:rt:")) != -1) {
+		switch(c) {
+			case 'c':
+				cleaning = 1;
+				break;
+			case 'r':
+				readahead = 1;
+				break;
+			case 't':
+				tracefile = optarg;
+				break;
+			case 'w':
+				cleaning = 1;
+				if(sscanf(optarg, "%d,%d", &lowWater, &highWater) != 2 || lowWater < 1 || highWater < lowWater) {
+					fprintf(stderr, "Error: Watermarks must be <low>,<high> with 1 <= low <= high\n");
+					return 1;
+				}
+				break;
+			default:
+				return 1;
+		}
+	}
+	argc -= optind - 1;
+	argv += optind - 1;
+
 	if(argc!=5) {
-		printf("Usage: ./virtmem <npages> <nframes> <rand|fifo|custom> <sort|scan|focus>\n");
+		printf("Usage: ./virtmem [-c] [-w <low>,<high>] [-r] [-t <trace>] <npages> <nframes> <rand|fifo|clock|custom> <sort|scan|focus>\n");
 		return 1;
 	}
 
@@ -83,15 +226,30 @@ int main( int argc, char *argv[] )
 
 	// create page table
 	struct page_table *pt;
-	if(strcmp(algorithm, "rand") == 0) {
-		pt = page_table_create( npages, nframes, rand_fault_handler );
-	} else if(strcmp(algorithm, "fifo") == 0) {
-		pt = page_table_create( npages, nframes, fifo_fault_handler );
-	} else if(strcmp(algorithm, "custom") == 0) { // lru algorithm
-		pt = page_table_create( npages, nframes, lru_fault_handler );
-	} else {
+	policy = NULL;
+	for(i = 0; i < NPOLICIES; i++) {
+		if(strcmp(algorithm, policies[i].name) == 0) {
+			policy = &policies[i];
+		}
+	}
+	if(!policy) {
 		fprintf(stderr, "Error: Unsupported algorithm: %s. Defaulting to rand\n", algorithm);
-		pt = page_table_create( npages, nframes, rand_fault_handler );
+		policy = &policies[0];
+	}
+	if(tracefile) {
+		traceFd = open(tracefile, O_CREAT|O_TRUNC|O_WRONLY, 0644);
+		struct trace_header header = {TRACE_MAGIC, TRACE_VERSION, npages, 0};
+		if(traceFd < 0 || write(traceFd, &header, sizeof(header)) != sizeof(header)) {
+			fprintf(stderr, "Error: Couldn't write the trace %s: %s\n", tracefile, strerror(errno));
+			return 1;
+		}
+		traceCurrent = -1;
+		traceCount = 0;
+		traceUsed = 0;
+		nframes = npages;
+		pt = page_table_create( npages, nframes, trace_fault_handler );
+	} else {
+		pt = page_table_create( npages, nframes, locked_fault_handler );
 	}
 	if(!pt) {
 		fprintf(stderr, "Error: Couldn't create page table: %s\n", strerror(errno));
@@ -102,12 +260,55 @@ int main( int argc, char *argv[] )
 	diskReads = 0;
 	diskWrites = 0;
 	pageFaults = 0;
+	referenceFaults = 0;
 	currFrame = 0;
+	clockHand = 0;
 
 	// allocate memory of global variables
-	frameArr = malloc(nframes*sizeof(int));
+	frameArr = calloc(nframes, sizeof(int));
 	frameTable = malloc(nframes*sizeof(struct frameEntry));
-	pageUsage = malloc(nframes*sizeof(int));
+	freeFrames = malloc(nframes*sizeof(int));
+	lruPrev = malloc(nframes*sizeof(int));
+	lruNext = malloc(nframes*sizeof(int));
+	if(!frameArr || !frameTable || !freeFrames || !lruPrev || !lruNext) {
+		fprintf(stderr, "Error: Couldn't allocate tables for %d frames\n", nframes);
+		return 1;
+	}
+
+	// every frame starts empty and off the lru list; frame 0 is used first
+	for(i = 0; i < nframes; i++) {
+		frameTable[i].bits = 0;
+		frameTable[i].referenced = 0;
+		frameTable[i].prefetched = 0;
+		frameTable[i].writing = 0;
+		freeFrames[i] = nframes - 1 - i;
+		lruPrev[i] = lruNext[i] = -1;
+	}
+	nfree = nframes;
+	lruHead = lruTail = -1;
+
+	raLast = raMarker = raNext = -1;
+	raStride = raSize = 0;
+	readaheadPages = readaheadHits = readaheadCalls = 0;
+
+	ndirty = 0;
+	stopCleaner = 0;
+	cleanerWrites = 0;
+	if(cleaning) {
+		if(!highWater) {
+			lowWater = nframes/8 > 1 ? nframes/8 : 1;
+			highWater = nframes/4 > lowWater ? nframes/4 : lowWater;
+		}
+		if(highWater > nframes) {
+			fprintf(stderr, "Error: High watermark (%d) above the number of frames (%d)\n", highWater, nframes);
+			return 1;
+		}
+		int err = pthread_create(&cleaner, NULL, cleaner_thread, pt);
+		if(err) {
+			fprintf(stderr, "Error: Couldn't start the cleaner: %s\n", strerror(err));
+			return 1;
+		}
+	}
 
 	virtmem = page_table_get_virtmem(pt);
 	physmem = page_table_get_physmem(pt);
@@ -124,169 +325,511 @@ int main( int argc, char *argv[] )
 	}
 
 	// clean up
+	struct disk_stats stats;
+	if(cleaning) {
+		pthread_mutex_lock(&frameLock);
+		stopCleaner = 1;
+		pthread_cond_signal(&cleanerWake);
+		pthread_mutex_unlock(&frameLock);
+		pthread_join(cleaner, NULL);
+	}
 	page_table_delete(pt);
+	disk_get_stats(disk, &stats);
 	disk_close(disk);
-	free(pageUsage);
+	free(lruNext);
+	free(lruPrev);
+	free(freeFrames);
 	free(frameTable);
 	free(frameArr);
 
-	fprintf(stdout, "disk reads (%d), disk writes (%d), page faults (%d)\n", diskReads, diskWrites, pageFaults);
+	if(tracefile) {
+		if(!trace_flush() || close(traceFd) < 0) {
+			fprintf(stderr, "Error: Couldn't write the trace %s: %s\n", tracefile, strerror(errno));
+			return 1;
+		}
+		fprintf(stdout, "recorded %ld references to %s\n", traceCount, tracefile);
+		return 0;
+	}
+
+	fprintf(stdout, "disk reads (%d), disk writes (%d), page faults (%d), reference faults (%d)\n", diskReads, diskWrites, pageFaults, referenceFaults);
+	if(readahead || cleaning) {
+		fprintf(stdout, "disk read calls (%ld), disk write calls (%ld)\n", stats.reads, stats.writes);
+	}
+	if(readahead) {
+		fprintf(stdout, "readahead pages (%d) in reads (%d), windows reached (%d)\n", readaheadPages, readaheadCalls, readaheadHits);
+	}
+	if(cleaning) {
+		fprintf(stdout, "cleaner writes (%d), writes while faulting (%d)\n", cleanerWrites, diskWrites - cleanerWrites);
+	}
 
 	return 0;
 }
 
-void rand_fault_handler( struct page_table *pt, int page )
+// Handle a fault for every policy: a miss reads the page into a free frame
+// or the policy's victim, and a write to a read-only page makes it writable
+void page_fault_handler( struct page_table *pt, int page )
 {
 	// printf("page fault on page %d\n", page);
 	// print_table();
 	int frame, bits;
+
+	// an access to a resident page that was being watched
+	frame = reference_fault(pt, page);
+	if(frame != -1) {
+		policy->access(frame);
+		readahead_hit(pt, page, frame);
+		return;
+	}
 	page_table_get_entry(pt, page, &frame, &bits);
 
 	// not in table
 	if(!bits) {
-		bits = PROT_READ;
-		frame = find_empty(pt);
-
-		// all pages filled
-		if(frame == -1) {
-			// find a random page
-			frame = rand() % nframes;
-			remove_page(pt, frame);
-		}
+		frame = take_frame(pt);
 
 		// read from the disk
 		disk_read(disk, page, &physmem[frame*PAGE_SIZE]);
 		diskReads++;
+
+		// add the new page to the frame table
+		policy->insert(frame, 1);
+		map_page(pt, page, frame, PROT_READ);
+		readahead_miss(pt, page, frame);
 	// no write
 	} else if(bits & PROT_READ) {
-		bits = PROT_READ | PROT_WRITE;
+		map_page(pt, page, frame, PROT_READ | PROT_WRITE);
+		policy->access(frame);
 	} else {
 		fprintf(stderr, "Error: Access fault on page #%d\n", page);
 		exit(1);
 	}
 
-	// add the new page to the frame table// add the new page to the frame table
-	page_table_set_entry(pt, page, frame, bits);
-	frameTable[frame].page = page;
-	frameTable[frame].bits = bits;
-
 	pageFaults++;
 	// print_table();
 }
 
-void fifo_fault_handler( struct page_table *pt, int page )
+// a free frame, or else the policy's victim once its page is out
+int take_frame( struct page_table *pt )
 {
-	// printf("page fault on page %d\n", page);
-	// print_table();
-	int frame, bits;
-	page_table_get_entry(pt, page, &frame, &bits);
+	int frame = find_empty(pt);
 
-	// not in table
-	if(!bits) {
-		bits = PROT_READ;
-		frame = find_empty(pt);
+	// all pages filled
+	if(frame == -1) {
+		frame = policy->victim(pt);
+		remove_page(pt, frame);
+	}
+	return frame;
+}
 
-		// all pages filled
-		if(frame == -1) {
-			frame = frameArr[currFrame];
-			remove_page(pt, frame);
-		}
+// find a random page
+int rand_victim( struct page_table *pt )
+{
+	return rand() % nframes;
+}
 
-		// read from the disk
-		disk_read(disk, page, &physmem[frame*PAGE_SIZE]);
-		diskReads++;
+void rand_insert( int frame, int used )
+{
+}
 
-		frameArr[currFrame] = frame;
-	// no write
-	} else if(bits & PROT_READ) {
-		bits = PROT_READ | PROT_WRITE;
+void rand_access( int frame )
+{
+}
+
+int fifo_victim( struct page_table *pt )
+{
+	return frameArr[currFrame];
+}
+
+// queue the frame, moving the frame pointer for the next access
+void fifo_insert( int frame, int used )
+{
+	frameArr[currFrame] = frame;
+	currFrame = (currFrame + 1) % nframes;
+}
+
+// every fault moves the frame pointer on
+void fifo_access( int frame )
+{
+	currFrame = (currFrame + 1) % nframes;
+}
+
+// evict the least recently used, giving pages referenced since they were
+// last here a second chance at the front of the list
+int lru_victim( struct page_table *pt )
+{
+	int frame;
+	while(frameTable[lruTail].referenced) {
+		frame = lruTail;
+		reference_clear(pt, frame);
+		lru_unlink(frame);
+		lru_push(frame);
+	}
+	return lruTail;
+}
+
+void lru_insert( int frame, int used )
+{
+	frameTable[frame].referenced = used;
+	lru_unlink(frame);
+	lru_push(frame);
+}
+
+// move the frame to the front of the list
+void lru_access( int frame )
+{
+	lru_insert(frame, 1);
+}
+
+// sweep past the referenced frames, clearing them as it goes
+int clock_victim( struct page_table *pt )
+{
+	int frame;
+	while(frameTable[clockHand].referenced) {
+		reference_clear(pt, clockHand);
+		clockHand = (clockHand + 1) % nframes;
+	}
+	frame = clockHand;
+	clockHand = (clockHand + 1) % nframes;
+	return frame;
+}
+
+void clock_insert( int frame, int used )
+{
+	frameTable[frame].referenced = used;
+}
+
+void clock_access( int frame )
+{
+	frameTable[frame].referenced = 1;
+}
+
+int find_empty( struct page_table *pt )
+{
+	// take a frame off the free stack, if memory isn't full yet
+	if(nfree == 0) {
+		return -1;
+	}
+	return freeFrames[--nfree];
+}
+
+// take the frame out of the lru list, if it is in it
+void lru_unlink( int frame )
+{
+	if(lruPrev[frame] != -1) {
+		lruNext[lruPrev[frame]] = lruNext[frame];
+	} else if(lruHead == frame) {
+		lruHead = lruNext[frame];
 	} else {
-		fprintf(stderr, "Error: Access fault on page #%d\n", page);
-		exit(1);
+		return;
 	}
+	if(lruNext[frame] != -1) {
+		lruPrev[lruNext[frame]] = lruPrev[frame];
+	} else {
+		lruTail = lruPrev[frame];
+	}
+	lruPrev[frame] = lruNext[frame] = -1;
+}
 
-	// add the new page to the frame table
+// put the frame at the front of the lru list
+void lru_push( int frame )
+{
+	lruPrev[frame] = -1;
+	lruNext[frame] = lruHead;
+	if(lruHead != -1) {
+		lruPrev[lruHead] = frame;
+	} else {
+		lruTail = frame;
+	}
+	lruHead = frame;
+}
+
+// remove the page from the frame table
+void remove_page( struct page_table *pt, int frame )
+{
+	// the frame can't be reused until its write-back has read it
+	while(frameTable[frame].writing) {
+		pthread_cond_wait(&writeDone, &frameLock);
+	}
+	if(frameTable[frame].bits & PROT_WRITE) {
+		disk_write(disk, frameTable[frame].page, &physmem[frame*PAGE_SIZE]);
+		diskWrites++;
+		ndirty--;
+	}
+	// the stream never got here, so read less
+	if(frameTable[frame].prefetched) {
+		frameTable[frame].prefetched = 0;
+		raSize = raSize/2 > RA_MIN ? raSize/2 : RA_MIN;
+	}
+	// clean the bits
+	page_table_set_entry(pt, frameTable[frame].page, frame, 0);
+	frameTable[frame].bits = 0;
+}
+
+// Software reference bits. The page table has no accessed bit, so a policy
+// clears a frame's bit by taking away all access to its page. The next
+// access then faults here, and the page gets its permissions back and is
+// marked referenced, without touching the disk. Returns the frame, or -1 if
+// the page wasn't resident.
+int reference_fault( struct page_table *pt, int page )
+{
+	int frame, bits;
+	page_table_get_entry(pt, page, &frame, &bits);
+	if(bits || frame < 0 || frame >= nframes || !frameTable[frame].bits || frameTable[frame].page != page) {
+		return -1;
+	}
+	page_table_set_entry(pt, page, frame, frameTable[frame].bits);
+	frameTable[frame].referenced = 1;
+	referenceFaults++;
+	return frame;
+}
+
+// clear the frame's reference bit, watching its page for the next access
+void reference_clear( struct page_table *pt, int frame )
+{
+	frameTable[frame].referenced = 0;
+	page_table_set_entry(pt, frameTable[frame].page, frame, PROT_NONE);
+}
+
+// run the policy with the frame table to itself
+void locked_fault_handler( struct page_table *pt, int page )
+{
+	pthread_mutex_lock(&frameLock);
+	page_fault_handler(pt, page);
+	pthread_mutex_unlock(&frameLock);
+}
+
+// map the page into the frame, keeping count of the dirty frames
+void map_page( struct page_table *pt, int page, int frame, int bits )
+{
+	if((bits & PROT_WRITE) && !(frameTable[frame].bits & PROT_WRITE)) {
+		ndirty++;
+		if(cleaning && nframes - ndirty < lowWater) {
+			pthread_cond_signal(&cleanerWake);
+		}
+	}
 	page_table_set_entry(pt, page, frame, bits);
 	frameTable[frame].page = page;
 	frameTable[frame].bits = bits;
+}
 
-	pageFaults++;
+// The i-th frame in roughly the order the policy will evict them, given the
+// one before it, or -1 past the end
+int cleaner_frame( int i, int prev )
+{
+	if(i >= nframes) {
+		return -1;
+	} else if(policy->victim == lru_victim) {
+		return i == 0 ? lruTail : lruPrev[prev];
+	} else if(policy->victim == clock_victim) {
+		return (clockHand + i) % nframes;
+	} else if(policy->victim == fifo_victim) {
+		return frameArr[(currFrame + i) % nframes];
+	}
+	return i;
+}
 
-	// move the frame pointer for the next access
-	currFrame = (currFrame + 1) % nframes;
-	// print_table();
+int compare_pages( const void *a, const void *b )
+{
+	return frameTable[*(const int *)a].page - frameTable[*(const int *)b].page;
 }
 
-void lru_fault_handler( struct page_table *pt, int page )
+// Write back dirty frames ahead of the policy. Each frame is made read only
+// first, so a write during its write-back faults and dirties it again, and
+// the lock is dropped for the writes themselves.
+void *cleaner_thread( void *arg )
+{
+	struct page_table *pt = arg;
+	int batch[CLEAN_BATCH], pages[CLEAN_BATCH];
+	char *data[CLEAN_BATCH];
+	int frame, bits, i, j, n;
+
+	pthread_mutex_lock(&frameLock);
+	while(!stopCleaner) {
+		if(nframes - ndirty >= lowWater) {
+			pthread_cond_wait(&cleanerWake, &frameLock);
+			continue;
+		}
+
+		// gather the dirty frames nearest to eviction
+		while(!stopCleaner && nframes - ndirty < highWater) {
+			n = 0;
+			int seen = 0;
+			for(frame = cleaner_frame(0, -1); frame != -1 && n < CLEAN_BATCH; frame = cleaner_frame(++seen, frame)) {
+				if(!(frameTable[frame].bits & PROT_WRITE) || frameTable[frame].writing) {
+					continue;
+				}
+				// keep a page that is being watched for references unmapped
+				page_table_get_entry(pt, frameTable[frame].page, &i, &bits);
+				if(bits) {
+					page_table_set_entry(pt, frameTable[frame].page, frame, PROT_READ);
+				}
+				frameTable[frame].bits = PROT_READ;
+				frameTable[frame].writing = 1;
+				ndirty--;
+				batch[n++] = frame;
+			}
+			if(n == 0) {
+				break;
+			}
+
+			// write in page order, so neighbouring pages go out together
+			qsort(batch, n, sizeof(int), compare_pages);
+			for(i = 0; i < n; i++) {
+				pages[i] = frameTable[batch[i]].page;
+				data[i] = &physmem[batch[i]*PAGE_SIZE];
+			}
+			pthread_mutex_unlock(&frameLock);
+
+			// each run of consecutive pages is a single write
+			for(i = 0; i < n; i = j) {
+				for(j = i + 1; j < n && pages[j] == pages[j - 1] + 1; j++);
+				disk_writev(disk, pages[i], &data[i], j - i);
+			}
+			pthread_mutex_lock(&frameLock);
+
+			for(i = 0; i < n; i++) {
+				frameTable[batch[i]].writing = 0;
+			}
+			diskWrites += n;
+			cleanerWrites += n;
+			pthread_cond_broadcast(&writeDone);
+		}
+
+		// nothing left to clean; wait for more frames to be dirtied
+		if(!stopCleaner && nframes - ndirty < lowWater) {
+			pthread_cond_wait(&cleanerWake, &frameLock);
+		}
+	}
+	pthread_mutex_unlock(&frameLock);
+	return NULL;
+}
+
+// whether the page is in a frame, mapped or being watched
+int resident( struct page_table *pt, int page )
 {
-	// printf("page fault on page %d\n", page);
-	// print_table();
 	int frame, bits;
 	page_table_get_entry(pt, page, &frame, &bits);
+	return bits || (frame >= 0 && frame < nframes && frameTable[frame].bits && frameTable[frame].page == page);
+}
 
-	// not in table
-	if(!bits) {
-		bits = PROT_READ;
-		frame = find_empty(pt);
-
-		// all pages filled
-		if(frame == -1) {
-			int i, max = 0;
-			for(i = 0; i < nframes; i++) {
-				if (pageUsage[i] > pageUsage[max]) {
-					max = i;
-				}
+// Read up to raSize pages from start along the stream into frames, stopping
+// at a page already in memory or at a window not reached yet. The frame of
+// the page that started it is kept. A run of consecutive pages is read with
+// a single call.
+void read_ahead( struct page_table *pt, int start, int keep )
+{
+	char *data[RA_MAX];
+	int frames[RA_MAX];
+	int n, i, page, frame;
+
+	for(n = 0, page = start; n < raSize && page >= 0 && page < npages && !resident(pt, page); n++, page += raStride) {
+		if(nfree > 0) {
+			frame = find_empty(pt);
+		} else {
+			// don't evict what was read ahead and not used yet either
+			frame = policy->victim(pt);
+			if(frame == keep || frameTable[frame].prefetched) {
+				break;
 			}
-			frame = max;
 			remove_page(pt, frame);
 		}
 
-		// read from the disk
-		disk_read(disk, page, &physmem[frame*PAGE_SIZE]);
-		diskReads++;
-	} else if(bits & PROT_READ) {
-		bits = PROT_READ | PROT_WRITE;
-	// no write
-	} else {
-		fprintf(stderr, "Error: Access fault on page #%d\n", page);
-		exit(1);
+		// claim the frame now, so the policy doesn't pick it again
+		policy->insert(frame, 0);
+		frameTable[frame].page = page;
+		frameTable[frame].bits = PROT_READ;
+		frameTable[frame].prefetched = 1;
+		frames[n] = frame;
+		data[n] = &physmem[frame*PAGE_SIZE];
+	}
+	if(n == 0) {
+		return;
 	}
 
-	// add the new page to the frame table
-	page_table_set_entry(pt, page, frame, bits);
-	frameTable[frame].page = page;
-	frameTable[frame].bits = bits;
-
-	pageUsage[frame] = 0;
-	int i;
-	for(i = 0; i < nframes; i++) {
-		pageUsage[i] += 1;
+	if(raStride == 1) {
+		disk_readv(disk, start, data, n);
+		readaheadCalls++;
+	} else {
+		for(i = 0; i < n; i++) {
+			disk_read(disk, start + i*raStride, data[i]);
+		}
+		readaheadCalls += n;
 	}
+	diskReads += n;
+	readaheadPages += n;
+
+	// map the pages, except the first with no access, so that the stream
+	// reaching this window is seen
+	for(i = 0, page = start; i < n; i++, page += raStride) {
+		page_table_set_entry(pt, page, frames[i], i == 0 ? PROT_NONE : PROT_READ);
+		frameTable[frames[i]].prefetched = i == 0;
+	}
+	raMarker = start;
+	raNext = page;
+}
 
-	pageFaults++;
-	// print_table();
+// a miss at the same stride as the last one starts a stream
+void readahead_miss( struct page_table *pt, int page, int frame )
+{
+	if(!readahead) {
+		return;
+	}
+	if(raLast != -1 && page - raLast == raStride && raStride != 0) {
+		raSize = RA_MIN < nframes/4 ? RA_MIN : nframes/4;
+		read_ahead(pt, page + raStride, frame);
+	} else if(raLast != -1) {
+		raStride = page - raLast;
+	}
+	raLast = page;
 }
 
-int find_empty( struct page_table *pt )
+// the stream reached the first page of a window, so read the next one
+void readahead_hit( struct page_table *pt, int page, int frame )
 {
-	// check frame table for an empty page
-	int i;
-	for(i = 0; i < nframes; i++) {
-		if(frameTable[i].bits == 0) {
-			return i;
+	if(!frameTable[frame].prefetched) {
+		return;
+	}
+	frameTable[frame].prefetched = 0;
+	readaheadHits++;
+	if(page == raMarker) {
+		raSize = raSize*2 < RA_MAX ? raSize*2 : RA_MAX;
+		if(raSize > nframes/4) {
+			raSize = nframes/4;
 		}
+		raLast = page;
+		read_ahead(pt, raNext, frame);
 	}
-	return -1;
 }
 
-// remove the page from the frame table
-void remove_page( struct page_table *pt, int frame )
+// Record a reference. A page that isn't accessible is being read, and the
+// page used before it is shut off; a write to the page in use comes next,
+// as the page is only readable at first.
+void trace_fault_handler( struct page_table *pt, int page )
 {
-	if(frameTable[frame].bits & PROT_WRITE) {
-		disk_write(disk, frameTable[frame].page, &physmem[frame*PAGE_SIZE]);
-		diskWrites++;
+	int frame, bits;
+	page_table_get_entry(pt, page, &frame, &bits);
+
+	if(!bits) {
+		if(traceCurrent != -1) {
+			page_table_set_entry(pt, traceCurrent, traceCurrent, PROT_NONE);
+		}
+		page_table_set_entry(pt, page, page, PROT_READ);
+		traceCurrent = page;
+	} else {
+		page_table_set_entry(pt, page, page, PROT_READ | PROT_WRITE);
 	}
-	// clean the bits
-	page_table_set_entry(pt, frameTable[frame].page, frame, 0);
-	frameTable[frame].bits = 0;
+
+	traceBuffer[traceUsed++] = TRACE_RECORD(page, bits != 0);
+	traceCount++;
+	if(traceUsed == TRACE_BUFFER && !trace_flush()) {
+		fprintf(stderr, "Error: Couldn't write the trace: %s\n", strerror(errno));
+		exit(1);
+	}
+}
+
+// write out the buffered references
+int trace_flush()
+{
+	size_t size = traceUsed*sizeof(uint32_t);
+	traceUsed = 0;
+	return write(traceFd, traceBuffer, size) == (ssize_t)size;
 }
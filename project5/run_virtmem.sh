@@ -2,7 +2,7 @@
 
 if [ $# -ne 2 ]
 then
-  echo 'usage: ./run_virtmem.sh <rand|fifo|custom> <sort|scan|focus>'
+  echo 'usage: ./run_virtmem.sh <rand|fifo|clock|custom> <sort|scan|focus>'
   exit
 fi
 
@@ -0,0 +1,35 @@
+/*
+Format of the reference traces that virtmem -t records and vmsim replays.
+A trace is a header followed by one 32-bit record per reference, in the
+byte order of the machine that recorded it.
+*/
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+
+#define TRACE_MAGIC 0x52544d56 /* "VMTR" */
+#define TRACE_VERSION 1
+
+struct trace_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t npages;
+	uint32_t reserved;
+};
+
+/*
+A record is the page number shifted left by one, with the low bit set for
+a write. Each visit to a page, from the first reference to it after another
+page until the next reference to another page, is one read record, followed
+by one write record if the page was written during the visit. The other
+references of the visit are left out, which changes no policy's faults: none
+of them can miss on the page just used.
+*/
+
+#define TRACE_RECORD(page,write) (((uint32_t)(page)<<1) | ((write) ? 1 : 0))
+#define TRACE_PAGE(record) ((int)((record)>>1))
+#define TRACE_WRITE(record) ((int)((record)&1))
+
+#endif
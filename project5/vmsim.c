@@ -0,0 +1,343 @@
+/*
+Offline replacement simulator for the virtual memory project.
+Replays a reference trace recorded with virtmem -t against every policy
+and a range of frame counts, and prints the disk reads and writes each
+would have made. LRU is found for every frame count in a single pass
+from stack distances; the others are simulated once per frame count.
+OPT, which evicts the page used furthest in the future, is the lower
+bound on reads for any policy.
+*/
+
+#include "trace.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// distance of a first reference, further than any memory
+#define NEVER 0x7fffffff
+
+struct result {
+	long reads;
+	long writes;
+};
+
+uint32_t *trace;
+long ntrace;
+int npages;
+
+// read the whole trace into memory
+int load_trace( const char *file )
+{
+	FILE *f = fopen(file, "rb");
+	if(!f) return 0;
+
+	struct trace_header header;
+	if(fread(&header, sizeof(header), 1, f) != 1 || header.magic != TRACE_MAGIC || header.version != TRACE_VERSION) {
+		fprintf(stderr, "Error: %s is not a virtmem trace\n", file);
+		fclose(f);
+		errno = EINVAL;
+		return 0;
+	}
+	npages = header.npages;
+
+	long size = 1 << 20;
+	trace = malloc(size*sizeof(uint32_t));
+	ntrace = 0;
+	while(trace) {
+		ntrace += fread(trace + ntrace, sizeof(uint32_t), size - ntrace, f);
+		if(ntrace < size) break;
+		size *= 2;
+		uint32_t *larger = realloc(trace, size*sizeof(uint32_t));
+		if(!larger) free(trace);
+		trace = larger;
+	}
+	fclose(f);
+	return trace != NULL;
+}
+
+// Fenwick tree over trace positions, marking each page's latest reference
+long *tree;
+
+void tree_add( long i, int value )
+{
+	for(i++; i <= ntrace; i += i & -i) tree[i] += value;
+}
+
+long tree_sum( long i )
+{
+	long sum = 0;
+	for(i++; i > 0; i -= i & -i) sum += tree[i];
+	return sum;
+}
+
+// Mattson's stack algorithm. A reference misses in an LRU memory of f frames
+// exactly when more than f - 1 other pages were used since the page was last,
+// so one pass over the stack distances gives the reads for every size. A
+// dirty page is written back for the sizes at least the largest distance
+// since its last write and below the distance of its next reference, or of
+// the end of the trace. Returns 0 if it can't allocate.
+int simulate_lru( struct result *results, int maxframes )
+{
+	long *last = malloc(npages*sizeof(long));
+	int *sinceWrite = malloc(npages*sizeof(int));
+	long *misses = calloc(maxframes + 2, sizeof(long));
+	long *writes = calloc(maxframes + 2, sizeof(long));
+	tree = calloc(ntrace + 1, sizeof(long));
+	long k;
+	int f;
+
+	if(!(last && sinceWrite && misses && writes && tree)) {
+		free(tree);
+		free(writes);
+		free(misses);
+		free(sinceWrite);
+		free(last);
+		return 0;
+	}
+
+	for(f = 0; f < npages; f++) {
+		last[f] = -1;
+		sinceWrite[f] = -1; // never written
+	}
+
+	for(k = 0; k < ntrace; k++) {
+		int page = TRACE_PAGE(trace[k]);
+		int d = NEVER;
+		if(last[page] != -1) {
+			d = tree_sum(k - 1) - tree_sum(last[page]) + 1;
+			tree_add(last[page], -1);
+		}
+		tree_add(k, 1);
+		last[page] = k;
+
+		misses[d > maxframes ? maxframes + 1 : d]++;
+		if(sinceWrite[page] != -1) {
+			int from = sinceWrite[page] > 1 ? sinceWrite[page] : 1;
+			int to = d > maxframes + 1 ? maxframes + 1 : d;
+			if(from < to) {
+				writes[from]++;
+				writes[to]--;
+			}
+			if(d > sinceWrite[page]) sinceWrite[page] = d;
+		}
+		if(TRACE_WRITE(trace[k])) sinceWrite[page] = 0;
+	}
+
+	// pages still dirty were written back if enough others came after them
+	for(f = 0; f < npages; f++) {
+		if(last[f] != -1 && sinceWrite[f] != -1) {
+			long d = tree_sum(ntrace - 1) - tree_sum(last[f]) + 1;
+			int from = sinceWrite[f] > 1 ? sinceWrite[f] : 1;
+			int to = d > maxframes + 1 ? maxframes + 1 : d;
+			if(from < to) {
+				writes[from]++;
+				writes[to]--;
+			}
+		}
+	}
+
+	// misses at f frames are the references further than f away
+	long further = misses[maxframes + 1], written = 0;
+	for(f = maxframes; f >= 1; f--) {
+		results[f].reads = further;
+		further += misses[f];
+	}
+	for(f = 1; f <= maxframes; f++) {
+		written += writes[f];
+		results[f].writes = written;
+	}
+
+	free(tree);
+	free(writes);
+	free(misses);
+	free(sinceWrite);
+	free(last);
+	return 1;
+}
+
+// Max-heap of resident pages by next use, for OPT. Entries go stale when
+// their page is used again, and are skipped when they reach the top.
+struct entry {
+	long next;
+	int page;
+};
+
+struct entry *heap;
+long nheap;
+
+void heap_push( long next, int page )
+{
+	long i = nheap++;
+	while(i > 0 && heap[(i - 1)/2].next < next) {
+		heap[i] = heap[(i - 1)/2];
+		i = (i - 1)/2;
+	}
+	heap[i].next = next;
+	heap[i].page = page;
+}
+
+struct entry heap_pop()
+{
+	struct entry top = heap[0], last = heap[--nheap];
+	long i = 0, child;
+	while((child = 2*i + 1) < nheap) {
+		if(child + 1 < nheap && heap[child + 1].next > heap[child].next) child++;
+		if(heap[child].next <= last.next) break;
+		heap[i] = heap[child];
+		i = child;
+	}
+	heap[i] = last;
+	return top;
+}
+
+// Simulate one policy with a memory of nframes frames. Memory fills in frame
+// order, as in virtmem, before the policy picks any victim. Returns 0 if it
+// can't allocate.
+int simulate( const char *policy, int nframes, long *nextUse, struct result *r )
+{
+	int *frameOf = malloc(npages*sizeof(int));
+	long *pageNext = malloc(npages*sizeof(long));
+	int *pageIn = malloc(nframes*sizeof(int));
+	char *dirty = calloc(npages, 1);
+	char *referenced = calloc(nframes, 1);
+	int used = 0, hand = 0, page, frame;
+	long k;
+
+	if(!(frameOf && pageNext && pageIn && dirty && referenced)) {
+		free(referenced);
+		free(dirty);
+		free(pageIn);
+		free(pageNext);
+		free(frameOf);
+		return 0;
+	}
+
+	r->reads = r->writes = 0;
+	for(page = 0; page < npages; page++) frameOf[page] = -1;
+	nheap = 0;
+	srand(1);
+
+	for(k = 0; k < ntrace; k++) {
+		page = TRACE_PAGE(trace[k]);
+		frame = frameOf[page];
+
+		if(frame == -1) {
+			r->reads++;
+			if(used < nframes) {
+				frame = used++;
+			} else {
+				if(strcmp(policy, "opt") == 0) {
+					struct entry e;
+					do {
+						e = heap_pop();
+					} while(frameOf[e.page] == -1 || pageNext[e.page] != e.next);
+					frame = frameOf[e.page];
+				} else if(strcmp(policy, "fifo") == 0) {
+					frame = hand;
+					hand = (hand + 1) % nframes;
+				} else if(strcmp(policy, "clock") == 0) {
+					while(referenced[hand]) {
+						referenced[hand] = 0;
+						hand = (hand + 1) % nframes;
+					}
+					frame = hand;
+					hand = (hand + 1) % nframes;
+				} else {
+					frame = rand() % nframes;
+				}
+
+				// evict
+				int victim = pageIn[frame];
+				if(dirty[victim]) {
+					r->writes++;
+					dirty[victim] = 0;
+				}
+				frameOf[victim] = -1;
+			}
+			pageIn[frame] = page;
+			frameOf[page] = frame;
+		}
+
+		referenced[frame] = 1;
+		if(TRACE_WRITE(trace[k])) dirty[page] = 1;
+		if(nextUse) {
+			pageNext[page] = nextUse[k];
+			heap_push(nextUse[k], page);
+		}
+	}
+
+	free(referenced);
+	free(dirty);
+	free(pageIn);
+	free(pageNext);
+	free(frameOf);
+	return 1;
+}
+
+int main( int argc, char *argv[] )
+{
+	if(argc < 2 || argc > 5) {
+		printf("Usage: ./vmsim <trace> [<min frames> [<max frames> [<step>]]]\n");
+		printf("Prints CSV lines of frames, policy, disk reads and disk writes for\n");
+		printf("opt, lru, fifo, clock and rand. (default=all frame counts)\n");
+		return 1;
+	}
+
+	if(!load_trace(argv[1])) {
+		fprintf(stderr, "Error: Couldn't read the trace %s: %s\n", argv[1], strerror(errno));
+		return 1;
+	}
+	int minframes = argc > 2 ? atoi(argv[2]) : 1;
+	int maxframes = argc > 3 ? atoi(argv[3]) : npages;
+	int step = argc > 4 ? atoi(argv[4]) : 1;
+	if(minframes < 1 || maxframes < minframes || maxframes > npages || step < 1) {
+		fprintf(stderr, "Error: Frames must be from 1 to %d pages, and the step at least 1\n", npages);
+		return 1;
+	}
+
+	// when each reference's page is next used, for OPT
+	long *nextUse = malloc(ntrace*sizeof(long));
+	long *seen = malloc(npages*sizeof(long));
+	heap = malloc((ntrace + 1)*sizeof(struct entry));
+	struct result *lru = calloc(maxframes + 1, sizeof(struct result));
+	if(!nextUse || !seen || !heap || !lru) {
+		fprintf(stderr, "Error: Couldn't allocate for %ld references\n", ntrace);
+		return 1;
+	}
+	long k;
+	int f, p;
+	for(p = 0; p < npages; p++) seen[p] = NEVER;
+	for(k = ntrace - 1; k >= 0; k--) {
+		p = TRACE_PAGE(trace[k]);
+		nextUse[k] = seen[p];
+		seen[p] = k;
+	}
+
+	if(!simulate_lru(lru, maxframes)) {
+		fprintf(stderr, "Error: Couldn't allocate for %ld references\n", ntrace);
+		return 1;
+	}
+
+	const char *policies[] = {"opt", "fifo", "clock", "rand"};
+	printf("frames,policy,reads,writes\n");
+	for(f = minframes; f <= maxframes; f += step) {
+		for(p = 0; p < 4; p++) {
+			struct result r;
+			if(!simulate(policies[p], f, p == 0 ? nextUse : NULL, &r)) {
+				fprintf(stderr, "Error: Couldn't allocate for %ld references\n", ntrace);
+				return 1;
+			}
+			printf("%d,%s,%ld,%ld\n", f, policies[p], r.reads, r.writes);
+		}
+		printf("%d,lru,%ld,%ld\n", f, lru[f].reads, lru[f].writes);
+	}
+
+	free(lru);
+	free(heap);
+	free(seen);
+	free(nextUse);
+	free(trace);
+	return 0;
+}